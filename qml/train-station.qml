@@ -51,10 +51,42 @@ ApplicationWindow
         Page {
             allowedOrientations: Orientation.Landscape
             enabled: InterConnect.operational
-            SilicaListView {
+            id: page
+            // Every track is on screen, all are watched while the
+            // application is in front.
+            function updateWatched() {
+                var tracks = InterConnect.tracks
+                for (var i = 0; i < tracks.length; i++) {
+                    tracks[i].watched = Qt.application.active
+                }
+            }
+            Component.onCompleted: updateWatched()
+            Connections {
+                target: InterConnect
+                onTracksChanged: page.updateWatched()
+            }
+            Connections {
+                target: Qt.application
+                onActiveChanged: page.updateWatched()
+            }
+            SilicaFlickable {
                 id: trackList
                 anchors.fill: parent
-                header: Item {
+                contentHeight: header.height + overview.height + trackMenu.height
+                PullDownMenu {
+                    MenuItem {
+                        text: InterConnect.hub
+                            ? "Stop sharing (" + InterConnect.hubClients + " client(s))"
+                            : "Share layout"
+                        onClicked: InterConnect.hub = !InterConnect.hub
+                    }
+                    MenuItem {
+                        text: "Emergency stop"
+                        onClicked: InterConnect.emergencyStop()
+                    }
+                }
+                Item {
+                    id: header
                     x: trackList.width - width
                     width: trackList.width / 3
                     height: btIcon.height
@@ -76,83 +108,82 @@ ApplicationWindow
                             : "no connected device"
                     }
                 }
-                model: InterConnect.tracks
-                delegate: ListItem {
-                    readonly property bool edited: slider.track == modelData
+                // One scene graph item for all the tracks, four rows per
+                // screen when there is room, down to small items.
+                TrackOverview {
+                    id: overview
+                    readonly property real rowHeight: Math.max(Theme.itemSizeSmall,
+                        (Screen.width - header.height) / Math.max(4, InterConnect.tracks.length))
+                    anchors.top: header.bottom
                     x: trackList.width - width
-                    width: trackList.width / 3
-                    contentHeight: (Screen.width - trackList.headerItem.height) / 4
-                    menu: ContextMenu {
-                        width: trackList.width / 3
-                        x: 0
-                        MenuItem {
-                            text: modelData.linked ? "Release track control" : "Control track"
-                            onClicked: {
-                                if (modelData.linked) {
-                                    modelData.release()
-                                } else {
-                                    modelData.acquire()
-                                }
+                    width: trackList.width / 3 - Theme.horizontalPageMargin
+                    height: rowHeight * InterConnect.tracks.length
+                    tracks: InterConnect.tracks
+                    current: slider.track
+                    color: Theme.primaryColor
+                    highlightColor: Theme.highlightColor
+                    paused: !Qt.application.active
+                    MouseArea {
+                        anchors.fill: parent
+                        onClicked: {
+                            var track = overview.trackAt(mouse.y)
+                            if (track && track.linked) {
+                                slider.track = slider.track == track ? null : track
                             }
                         }
-                    }
-                    onClicked: {
-                        if (modelData.linked) {
-                            slider.track = edited ? null : modelData
+                        onPressAndHold: {
+                            var index = overview.indexAt(mouse.y)
+                            if (index >= 0) {
+                                menuAnchor.track = overview.trackAt(mouse.y)
+                                menuAnchor.y = overview.y + (index + 1) * overview.rowHeight
+                                trackMenu.open(menuAnchor)
+                            }
                         }
                     }
-                    Icon {
-                        anchors.top: parent.top
-                        anchors.topMargin: Theme.paddingSmall / 2
-                        anchors.horizontalCenter: parent.horizontalCenter
-                        source: "image://theme/icon-s-edit"
-                        visible: modelData.linked
-                        highlighted: parent.highlighted || edited
-                    }
-                    Icon {
-                        id: backward
-                        anchors.verticalCenter: parent.verticalCenter
-                        anchors.left: parent.left
-                        anchors.leftMargin: Theme.paddingSmall
-                        source: "image://theme/icon-splus-left"
-                        highlighted: modelData.direction == Track.BACKWARD
-                    }
-                    Slider {
-                        enabled: false
-                        anchors.verticalCenter: parent.verticalCenter
-                        anchors.left: parent.left
-                        anchors.leftMargin: Theme.paddingSmall
-                        anchors.right: parent.right
-                        anchors.rightMargin: Theme.horizontalPageMargin
-                        leftMargin: backward.width + Theme.paddingSmall
-                        rightMargin: forward.width + Theme.paddingSmall
-                        label: modelData.label + (modelData.capabilities & Track.POSITIONING ? " | " + modelData.count + " passage(s)" : "")
-                        value: modelData.speed
-                    }
-                    Icon {
-                        id: forward
-                        anchors.verticalCenter: parent.verticalCenter
-                        anchors.right: parent.right
-                        anchors.rightMargin: Theme.horizontalPageMargin
-                        source: "image://theme/icon-splus-right"
-                        highlighted: modelData.direction == Track.FORWARD
+                }
+                Item {
+                    id: menuAnchor
+                    property QtObject track
+                    x: overview.x
+                    width: overview.width
+                }
+                ContextMenu {
+                    id: trackMenu
+                    MenuItem {
+                        text: menuAnchor.track && menuAnchor.track.linked
+                            ? "Release track control" : "Control track"
+                        onClicked: {
+                            if (menuAnchor.track.linked) {
+                                menuAnchor.track.release()
+                            } else {
+                                menuAnchor.track.acquire()
+                            }
+                        }
                     }
                 }
+                VerticalScrollDecorator {}
             }
             InfoLabel {
                 x: parent.width - width
                 width: parent.width / 3
                 height: Screen.width
                 verticalAlignment: Text.AlignVCenter
-                visible: trackList.model.length == 0
+                visible: InterConnect.tracks.length == 0
                 text: "no tracks"
             }
             Slider {
                 id: slider
 
                 property QtObject track
+                property QtObject focusedTrack
                 onTrackChanged: {
+                    // Reported at the highest rate while on the slider.
+                    if (focusedTrack) {
+                        focusedTrack.focused = false
+                    }
+                    focusedTrack = track
                     if (track) {
+                        track.focused = true
                         value = track.direction == Track.FORWARD ? track.speed : -track.speed
                     }
                 }
@@ -172,8 +203,10 @@ ApplicationWindow
                     }
                 }
                 onValueChanged: {
-                    if (track) {
-                        track.requestSpeed(speedValue)
+                    // Back to the current speed when a hub client
+                    // drives the track.
+                    if (track && !InterConnect.requestSpeed(track, speedValue)) {
+                        value = track.direction == Track.FORWARD ? track.speed : -track.speed
                     }
                 }
 
@@ -200,22 +233,13 @@ ApplicationWindow
         id: cover
         CoverBackground {
             id: coverBackground
-            Column {
-                width: parent.width
-                Repeater {
-                    model: InterConnect.tracks
-                    delegate: Item {
-                        width: parent.width
-                        height: coverBackground.height / InterConnect.tracks.length
-                        Slider {
-                            enabled: false
-                            width: parent.width
-                            anchors.verticalCenter: parent.verticalCenter
-                            label: modelData.label + (modelData.capabilities & Track.POSITIONING ? " | " + modelData.count + " passage(s)" : "")
-                            value: modelData.speed
-                        }
-                    }
-                }
+            TrackOverview {
+                anchors.fill: parent
+                anchors.margins: Theme.paddingMedium
+                tracks: InterConnect.tracks
+                color: Theme.primaryColor
+                highlightColor: Theme.highlightColor
+                paused: InterConnect.idle || coverBackground.status == Cover.Inactive
             }
             InfoLabel {
                 x: 0
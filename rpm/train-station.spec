@@ -10,6 +10,7 @@ BuildRequires:  cmake
 BuildRequires:  extra-cmake-modules
 BuildRequires:  pkgconfig(sailfishapp) >= 1.0.2
 BuildRequires:  pkgconfig(Qt5Core)
+BuildRequires:  pkgconfig(Qt5Network)
 BuildRequires:  pkgconfig(Qt5Qml)
 BuildRequires:  pkgconfig(Qt5Quick)
 BuildRequires:  pkgconfig(Qt5DBus)
@@ -23,7 +24,7 @@ A train controller application.
 %setup -q -n %{name}-%{version}
 
 %build
-%cmake
+%cmake -DBUILD_TESTING=OFF
 make %{?_smp_mflags}
 
 %install
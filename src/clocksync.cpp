@@ -0,0 +1,100 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "clocksync.h"
+
+static const double MAX_DRIFT = 1e-3;
+
+ClockSync::ClockSync()
+{
+    mSamples.reserve(WINDOW);
+}
+
+ClockSync::~ClockSync()
+{
+}
+
+void ClockSync::sample(qint64 t1, qint64 t2, qint64 t3, qint64 t4)
+{
+    mProcessing = t3 - t2;
+    mDelay = (t4 - t1) - mProcessing;
+    if (mDelay < 0)
+        return;
+
+    Sample sample;
+    sample.mHost = t1 + (t4 - t1) / 2;
+    sample.mOffset = ((t2 - t1) + (t3 - t4)) / 2;
+    sample.mDelay = mDelay;
+    if (mSamples.size() < WINDOW) {
+        mSamples.append(sample);
+    } else {
+        mSamples[mHead] = sample;
+        mHead = (mHead + 1) % WINDOW;
+    }
+
+    // The exchange least delayed by queuing is the most accurate.
+    const Sample *best = &mSamples.first();
+    for (const Sample &s : mSamples) {
+        if (s.mDelay < best->mDelay)
+            best = &s;
+    }
+    mReference = best->mHost;
+    mOffset = best->mOffset;
+
+    double meanHost = 0., meanOffset = 0.;
+    for (const Sample &s : mSamples) {
+        meanHost += s.mHost - mReference;
+        meanOffset += s.mOffset - mOffset;
+    }
+    meanHost /= mSamples.size();
+    meanOffset /= mSamples.size();
+    double covariance = 0., variance = 0.;
+    for (const Sample &s : mSamples) {
+        const double host = s.mHost - mReference - meanHost;
+        covariance += host * (s.mOffset - mOffset - meanOffset);
+        variance += host * host;
+    }
+    // Bound to what a crystal can do, against a window of poor samples.
+    mDrift = variance > 0. ? qBound(-MAX_DRIFT, covariance / variance, MAX_DRIFT) : 0.;
+}
+
+void ClockSync::clear()
+{
+    mSamples.clear();
+    mHead = 0;
+    mDrift = 0.;
+}
+
+bool ClockSync::synchronized() const
+{
+    return !mSamples.isEmpty();
+}
+
+qint64 ClockSync::offset(qint64 now) const
+{
+    return mOffset + qint64(mDrift * (now - mReference));
+}
+
+double ClockSync::drift() const
+{
+    return mDrift * 1e6;
+}
+
+qint64 ClockSync::delay() const
+{
+    return mDelay;
+}
+
+qint64 ClockSync::processing() const
+{
+    return mProcessing;
+}
+
+qint64 ClockSync::toHost(qint64 deviceTime) const
+{
+    // Host time h such that h + offset(h) is the device time.
+    return mReference + qint64((deviceTime - mOffset - mReference) / (1. + mDrift));
+}
@@ -0,0 +1,56 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include <QVector>
+
+// NTP like estimation of a device clock against the host clock, see
+// History::nowUs(). Each exchange gives four timestamps, in µs: host
+// send t1, device receive t2, device send t3 and host receive t4.
+// The offset is taken from the exchange with the shortest round trip
+// in the window, the drift from a least square fit of the offsets.
+class ClockSync
+{
+public:
+    ClockSync();
+    ~ClockSync();
+
+    static const int WINDOW = 8;
+
+    void sample(qint64 t1, qint64 t2, qint64 t3, qint64 t4);
+    void clear();
+
+    bool synchronized() const;
+    // Device minus host time, at host time now.
+    qint64 offset(qint64 now) const;
+    // In parts per million of the host clock.
+    double drift() const;
+    // Radio round trip and device processing time of the last exchange.
+    qint64 delay() const;
+    qint64 processing() const;
+
+    qint64 toHost(qint64 deviceTime) const;
+
+private:
+    struct Sample
+    {
+        qint64 mHost = 0;
+        qint64 mOffset = 0;
+        qint64 mDelay = 0;
+    };
+
+    QVector<Sample> mSamples;
+    int mHead = 0;
+    qint64 mReference = 0;
+    qint64 mOffset = 0;
+    double mDrift = 0.;
+    qint64 mDelay = 0;
+    qint64 mProcessing = 0;
+};
+
+#endif
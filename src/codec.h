@@ -0,0 +1,79 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <QtGlobal>
+#include <QtEndian>
+
+// Compile time generated encoders and decoders for fixed size frames.
+// A frame is described by its type and the list of its fields, see
+// protocol.h. Integers are little endian on the wire.
+namespace Codec {
+
+template <typename... Fields> struct Size;
+
+template <> struct Size<>
+{
+    static constexpr int VALUE = 0;
+};
+
+template <typename Field, typename... Fields> struct Size<Field, Fields...>
+{
+    static constexpr int VALUE = int(sizeof(Field)) + Size<Fields...>::VALUE;
+};
+
+inline void put(char *)
+{
+}
+
+template <typename Field, typename... Fields>
+inline void put(char *pt, Field value, Fields... values)
+{
+    qToLittleEndian<Field>(value, reinterpret_cast<uchar*>(pt));
+    put(pt + sizeof(Field), values...);
+}
+
+inline void get(const char *)
+{
+}
+
+template <typename Field, typename... Fields>
+inline void get(const char *pt, Field &value, Fields&... values)
+{
+    value = qFromLittleEndian<Field>(reinterpret_cast<const uchar*>(pt));
+    get(pt + sizeof(Field), values...);
+}
+
+template <quint32 Type, typename... Fields>
+struct Message
+{
+    static constexpr quint32 TYPE = Type;
+    static constexpr int SIZE = int(sizeof(quint32)) + Size<Fields...>::VALUE;
+    typedef char Buffer[SIZE];
+
+    // Write the frame into buffer, return the number of bytes used.
+    static int encode(Buffer &buffer, Fields... values)
+    {
+        put(buffer, TYPE, values...);
+        return SIZE;
+    }
+
+    // Read the fields of data, return false if it is not such a frame.
+    static bool decode(const char *data, int length, Fields&... values)
+    {
+        if (length < SIZE
+            || qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(data)) != TYPE)
+            return false;
+        get(data + sizeof(quint32), values...);
+        return true;
+    }
+};
+
+}
+
+#endif
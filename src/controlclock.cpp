@@ -0,0 +1,71 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "controlclock.h"
+
+#include "track.h"
+
+ControlClock::ControlClock(int interval, QObject *parent)
+    : QObject(parent)
+{
+    mTimer.setInterval(interval);
+    mTimer.setTimerType(Qt::PreciseTimer);
+    connect(&mTimer, &QTimer::timeout, this, &ControlClock::tick);
+}
+
+ControlClock::~ControlClock()
+{
+}
+
+int ControlClock::interval() const
+{
+    return mTimer.interval();
+}
+
+void ControlClock::subscribe(Track *track)
+{
+    if (mTracks.contains(track))
+        return;
+
+    mTracks.insert(track);
+    connect(track, &QObject::destroyed,
+            this, &ControlClock::forget, Qt::UniqueConnection);
+    if (!mTimer.isActive())
+        mTimer.start();
+}
+
+void ControlClock::unsubscribe(Track *track)
+{
+    mTracks.remove(track);
+    if (mTracks.isEmpty())
+        mTimer.stop();
+}
+
+bool ControlClock::isSubscribed(Track *track) const
+{
+    return mTracks.contains(track);
+}
+
+void ControlClock::tick()
+{
+    const float interval = float(mTimer.interval()) / 1000.;
+    // Iterate on a copy, commands may subscribe or unsubscribe tracks.
+    const QSet<Track*> tracks = mTracks;
+    for (Track *track : tracks) {
+        if (!mTracks.contains(track))
+            continue;
+        if (!track->step(interval)) {
+            mTracks.remove(track);
+        }
+    }
+    if (mTracks.isEmpty())
+        mTimer.stop();
+}
+
+void ControlClock::forget(QObject *object)
+{
+    unsubscribe(static_cast<Track*>(object));
+}
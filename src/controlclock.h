@@ -0,0 +1,41 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CONTROLCLOCK_H
+#define CONTROLCLOCK_H
+
+#include <QObject>
+#include <QTimer>
+#include <QSet>
+
+class Track;
+
+// A fixed rate tick shared by all tracks. Tracks subscribe while
+// they have something to stream (like a speed ramp) and are ticked
+// together, so the command rate is bounded by one frame per track
+// and per interval.
+class ControlClock: public QObject
+{
+    Q_OBJECT
+ public:
+    ControlClock(int interval = 100, QObject *parent = nullptr);
+    ~ControlClock();
+
+    int interval() const;
+
+    void subscribe(Track *track);
+    void unsubscribe(Track *track);
+    bool isSubscribed(Track *track) const;
+
+ private:
+    void tick();
+    void forget(QObject *object);
+
+    QTimer mTimer;
+    QSet<Track*> mTracks;
+};
+
+#endif
@@ -0,0 +1,413 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "controller.h"
+
+#include <QDebug>
+#include <QTimer>
+#include <QtEndian>
+#include <cstring>
+
+#include "track.h"
+#include "protocol.h"
+
+Controller::Controller(const QString &address, const QString &name,
+                       const QString &adapter,
+                       QSharedPointer<QLocalSocket> socket,
+                       QObject *parent)
+    : QObject(parent)
+    , mAddress(address)
+    , mName(name)
+    , mAdapter(adapter)
+    , mSocket(socket)
+{
+    connect(mSocket.data(), &QIODevice::readyRead,
+            this, &Controller::dataAvailable);
+    connect(mSocket.data(), &QIODevice::bytesWritten,
+            this, &Controller::bytesWritten);
+    // Queued, since a write may notice the disconnection while the
+    // controllers are being iterated.
+    connect(mSocket.data(), &QLocalSocket::disconnected,
+            this, &Controller::linkLost, Qt::QueuedConnection);
+    // Room for a typical batch of frames.
+    mPending.reserve(CONGESTION_THRESHOLD);
+    mPendingLengths.reserve(Framing::WINDOW);
+}
+
+Controller::~Controller()
+{
+}
+
+QString Controller::address() const
+{
+    return mAddress;
+}
+
+QString Controller::name() const
+{
+    return mName;
+}
+
+QString Controller::adapter() const
+{
+    return mAdapter;
+}
+
+QList<Track*> Controller::tracks() const
+{
+    return mTrackList;
+}
+
+Track* Controller::track(int id) const
+{
+    return mTracks.value(id, nullptr);
+}
+
+bool Controller::checkAlive()
+{
+    const bool alive = mAlive;
+    mAlive = false;
+    return alive;
+}
+
+qint64 Controller::traffic() const
+{
+    return mTraffic;
+}
+
+float Controller::sampleThroughput(int interval)
+{
+    mThroughput = float(mTraffic - mSampledTraffic) * 1000. / interval;
+    mSampledTraffic = mTraffic;
+    return mThroughput;
+}
+
+float Controller::throughput() const
+{
+    return mThroughput;
+}
+
+void Controller::send(const char *data, int length)
+{
+    mPending.append(data, length);
+    mPendingLengths.append(length);
+    if (!mFlushScheduled) {
+        mFlushScheduled = true;
+        QTimer::singleShot(0, this, &Controller::flush);
+    }
+    updateCongestion();
+}
+
+void Controller::sendUrgent(const QByteArray &data)
+{
+    // The pending frames are kept, they are written just after.
+    write(data);
+    updateCongestion();
+}
+
+void Controller::write(const QByteArray &data)
+{
+    mTraffic += data.length();
+    if (mSocket->write(data) != data.length()) {
+        qWarning() << "Error sending" << data.length() << "bytes to" << mAddress;
+    }
+    // Push it to the file descriptor now, without waiting for the event loop.
+    mSocket->flush();
+}
+
+void Controller::flush()
+{
+    mFlushScheduled = false;
+    if (mPending.isEmpty())
+        return;
+
+    // The previous write is not drained yet, the link is stalling.
+    if (mSocket->bytesToWrite() > 0 && !mStallStart.isValid()) {
+        mStalls += 1;
+        mStallStart.start();
+        qDebug() << "write stall on" << mAddress << mSocket->bytesToWrite() << "bytes buffered";
+    }
+    if (mFramed) {
+        QByteArray data;
+        int at = 0;
+        for (int length : mPendingLengths) {
+            data.append(mFraming.wrap(mPending.constData() + at, length));
+            at += length;
+        }
+        write(data);
+    } else {
+        write(mPending);
+    }
+    mPending.resize(0);
+    mPendingLengths.resize(0);
+    updateCongestion();
+}
+
+void Controller::dropSpeedCommands()
+{
+    // Compact the pending frames in place, keeping everything but the
+    // speed commands.
+    int from = 0;
+    int to = 0;
+    int count = 0;
+    for (int i = 0; i < mPendingLengths.size(); i++) {
+        const int length = mPendingLengths.at(i);
+        const quint32 type = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(mPending.constData() + from));
+        if (type != Frame::SPEED_COMMAND && type != Frame::SCHEDULED_SPEED) {
+            if (to != from)
+                memmove(mPending.data() + to, mPending.constData() + from, length);
+            mPendingLengths[count++] = length;
+            to += length;
+        }
+        from += length;
+    }
+    if (count < mPendingLengths.size())
+        qWarning() << "dropping" << mPendingLengths.size() - count << "pending speed commands for" << mAddress;
+    mPending.resize(to);
+    mPendingLengths.resize(count);
+}
+
+void Controller::bytesWritten()
+{
+    if (mSocket->bytesToWrite() == 0 && mStallStart.isValid()) {
+        mStallTime += mStallStart.nsecsElapsed() / 1000;
+        mStallStart.invalidate();
+    }
+    updateCongestion();
+}
+
+void Controller::updateCongestion()
+{
+    const bool congested = backlog() > CONGESTION_THRESHOLD;
+    if (congested != mCongested) {
+        mCongested = congested;
+        emit congestionChanged();
+    }
+}
+
+qint64 Controller::backlog() const
+{
+    return mPending.length() + mSocket->bytesToWrite();
+}
+
+bool Controller::congested() const
+{
+    return mCongested;
+}
+
+int Controller::stalls() const
+{
+    return mStalls;
+}
+
+qint64 Controller::stallTime() const
+{
+    return mStallTime;
+}
+
+void Controller::emergencyStop()
+{
+    // Pending speed commands are superseded by the stop, the other
+    // pending frames (acquisitions, ping replies...) are still due.
+    // Speed commands already written are not resent on a NACK
+    // anymore, the current null commands are resent instead.
+    dropSpeedCommands();
+    if (mFramed)
+        mFraming.forget();
+
+    // Stop frames for all tracks, regardless of their link state,
+    // written in one go.
+    QByteArray frames;
+    for (Track *track : mTrackList) {
+        track->cancelCommands();
+        Protocol::SpeedCommand::Buffer buffer;
+        const int length = Protocol::SpeedCommand::encode(buffer, track->id(), 0);
+        if (mFramed) {
+            frames.append(mFraming.wrap(buffer, length));
+        } else {
+            frames.append(buffer, length);
+        }
+    }
+    if (!frames.isEmpty())
+        sendUrgent(frames);
+    flush();
+}
+
+const ClockSync& Controller::clockSync() const
+{
+    return mClockSync;
+}
+
+qint64 Controller::reportLatency() const
+{
+    return mReportLatency;
+}
+
+bool Controller::supports(Frame::Feature feature) const
+{
+    return mFeatures & feature;
+}
+
+void Controller::dataAvailable()
+{
+    const QByteArray data = mSocket->readAll();
+    mTraffic += data.length();
+    // The device keeps sending plain frames until it has read PROTOCOL.
+    if (!mFramed || (!mRxFramed && !Framing::isFramed(data))) {
+        readFrame(Frame(data));
+        return;
+    }
+
+    mFraming.feed(data);
+    QByteArray payload;
+    while (mFraming.next(&payload)) {
+        if (!mRxFramed) {
+            // Plain frames sent meanwhile may have been lost.
+            qDebug() << "framing confirmed by" << mAddress;
+            mRxFramed = true;
+            requestState();
+        }
+        readFrame(Frame(payload));
+    }
+    // Some device frames were lost or corrupted, ask for the current
+    // state of all tracks instead of dropping the link.
+    if (mFraming.takeResync()) {
+        qWarning() << "requesting state resynchronisation from" << mAddress
+                   << mFraming.lost() << "lost," << mFraming.corrupted() << "corrupted";
+        requestState();
+    }
+}
+
+void Controller::requestState()
+{
+    Protocol::StateRequest::Buffer buffer;
+    send(buffer, Protocol::StateRequest::encode(buffer));
+}
+
+void Controller::readFrame(const Frame &frame)
+{
+    switch (frame.type()) {
+    case Frame::PING: {
+        qDebug() << "received a ping frame, preparing response" << mAddress;
+        Protocol::Ping::Buffer buffer;
+        send(buffer, Protocol::Ping::encode(buffer, frame.pingCount()));
+        mAlive = true;
+        if (supports(Frame::TIMESTAMPS)) {
+            Protocol::TimeRequest::Buffer request;
+            send(request, Protocol::TimeRequest::encode(request, History::nowUs()));
+        }
+        return;
+    }
+    case Frame::TIME_REPLY: {
+        const qint64 t4 = History::nowUs();
+        qint64 t1, t2, t3;
+        frame.timeReply(&t1, &t2, &t3);
+        if (t1 > t4) {
+            qWarning() << "time reply from the future" << mAddress;
+            return;
+        }
+        mClockSync.sample(t1, t2, t3, t4);
+        qDebug() << "clock of" << mAddress << "offset" << mClockSync.offset(t4) << "us,"
+                 << "drift" << mClockSync.drift() << "ppm, radio round trip"
+                 << mClockSync.delay() << "us, device processing"
+                 << mClockSync.processing() << "us";
+        return;
+    }
+    case Frame::CAPABILITIES: {
+        // Sent plain, everything after is framed. Enabled before the
+        // tracks are announced, so that they can use the features.
+        const quint32 features = mFeatures
+            | (frame.features() & (Frame::FRAMING | Frame::REPORT_RATE
+                                | Frame::TIMESTAMPS | Frame::SCHEDULED));
+        if (features != mFeatures) {
+            qDebug() << "enabling features" << features << "with" << mAddress;
+            Protocol::Features::Buffer buffer;
+            send(buffer, Protocol::Features::encode(buffer, features));
+            // PROTOCOL and what precedes it go plain.
+            flush();
+            mFeatures = features;
+            mFramed = features & Frame::FRAMING;
+        }
+        for (const Track::Definition &definition : frame.trackDefinitions()) {
+            Track *track = new Track(definition, this);
+            if (mTracks.contains(track->id())) {
+                qWarning() << "unable to redefine track" << mAddress << track->id();
+                delete track;
+            } else {
+                qDebug() << "inserting a new track" << mAddress << track->id() << track->label();
+                mTracks.insert(track->id(), track);
+                mTrackList.append(track);
+                emit trackAdded(track);
+            }
+        }
+        emit tracksChanged();
+        return;
+    }
+    case Frame::NACK: {
+        // The device missed some of our frames, send them again when
+        // still available, or the current commands otherwise.
+        const int sequence = frame.nackSequence();
+        qWarning() << "device" << mAddress << "missed frames from" << sequence;
+        QByteArray data;
+        if (mFramed && mFraming.resend(quint16(sequence), &data)) {
+            // Ahead of the pending frames, that are not numbered yet.
+            write(data);
+        } else {
+            for (Track *track : mTrackList) {
+                track->resendCommand();
+            }
+        }
+        return;
+    }
+    case Frame::TRACK_STATE: {
+        int id;
+        const Track::State state = frame.trackState(&id);
+        Track *tr = track(id);
+        if (!tr) {
+            qWarning() << "unknown track" << mAddress << id;
+        } else {
+            qDebug() << "updating state" << mAddress << id;
+            qint64 time = -1;
+            if (frame.deviceTime() >= 0 && supports(Frame::TIMESTAMPS)
+                && mClockSync.synchronized()) {
+                const qint64 happened = mClockSync.toHost(frame.deviceTime());
+                mReportLatency = History::nowUs() - happened;
+                time = happened;
+            }
+            tr->setState(state, time);
+        }
+        return;
+    }
+    case Frame::ACQUIRE_ACK: {
+        int id;
+        bool ack = frame.ack(&id);
+        Track *tr = track(id);
+        if (!tr) {
+            qWarning() << "unknown track" << mAddress << id;
+        } else {
+            qDebug() << "acquire ack" << mAddress << id << ack;
+            if (ack)
+                tr->setLinked(true);
+        }
+        return;
+    }
+    case Frame::RELEASE_ACK: {
+        int id;
+        bool ack = frame.ack(&id);
+        Track *tr = track(id);
+        if (!tr) {
+            qWarning() << "unknown track" << mAddress << id;
+        } else {
+            qDebug() << "release ack" << mAddress << id << ack;
+            if (ack)
+                tr->setLinked(false);
+        }
+        return;
+    }
+    default:
+        return;
+    }
+}
@@ -0,0 +1,117 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QLocalSocket>
+#include <QHash>
+#include <QVector>
+#include <QElapsedTimer>
+
+#include "frame.h"
+#include "framing.h"
+#include "clocksync.h"
+
+class Track;
+
+// The context of one connected device: it owns the socket, the
+// tracks defined by the device, its liveness state and its send path.
+class Controller: public QObject
+{
+    Q_OBJECT
+ public:
+    Controller(const QString &address, const QString &name,
+               const QString &adapter,
+               QSharedPointer<QLocalSocket> socket,
+               QObject *parent = nullptr);
+    ~Controller();
+
+    QString address() const;
+    QString name() const;
+    QString adapter() const;
+
+    QList<Track*> tracks() const;
+    Track* track(int id) const;
+
+    bool checkAlive();
+    qint64 traffic() const;
+    float sampleThroughput(int interval);
+    float throughput() const;
+
+    // Frames sent within the same event loop turn are gathered and
+    // written at once on the next turn. They are framed only then, so
+    // that frames dropped before never use a sequence number.
+    void send(const char *data, int length);
+    // Write data, already framed if need be, ahead of the gathered
+    // frames. Bytes already handed to the socket are not preempted.
+    void sendUrgent(const QByteArray &data);
+    // Write the gathered frames now, instead of on the next turn.
+    void flush();
+    void emergencyStop();
+
+    // Whether an optional protocol feature is in use with the device.
+    bool supports(Frame::Feature feature) const;
+
+    // Bytes queued but not yet handed to the link, either here or in
+    // the socket buffer. Callers are expected to hold optional
+    // commands back while the controller is congested.
+    static const int CONGESTION_THRESHOLD = 256;
+    qint64 backlog() const;
+    bool congested() const;
+    int stalls() const;
+    qint64 stallTime() const;
+
+    // Clock synchronisation with the device, when it supports
+    // TIMESTAMPS, and the one way latency, in µs, of the last stamped
+    // TRACK_STATE.
+    const ClockSync& clockSync() const;
+    qint64 reportLatency() const;
+
+ signals:
+    void trackAdded(Track *track);
+    void tracksChanged();
+    void congestionChanged();
+    // The socket was closed by the other end.
+    void linkLost();
+
+ private:
+    void dataAvailable();
+    void readFrame(const Frame &frame);
+    void write(const QByteArray &data);
+    void dropSpeedCommands();
+    void requestState();
+    void bytesWritten();
+    void updateCongestion();
+
+    QString mAddress;
+    QString mName;
+    QString mAdapter;
+    QSharedPointer<QLocalSocket> mSocket;
+    QList<Track*> mTrackList;
+    QHash<int, Track*> mTracks;
+    bool mAlive = true;
+    qint64 mTraffic = 0;
+    qint64 mSampledTraffic = 0;
+    float mThroughput = 0.;
+    bool mFramed = false;
+    bool mRxFramed = false;
+    quint32 mFeatures = Frame::NO_FEATURE;
+    Framing mFraming;
+    ClockSync mClockSync;
+    qint64 mReportLatency = 0;
+    QByteArray mPending;
+    QVector<int> mPendingLengths;
+    bool mFlushScheduled = false;
+    bool mCongested = false;
+    int mStalls = 0;
+    qint64 mStallTime = 0;
+    QElapsedTimer mStallStart;
+};
+
+#endif
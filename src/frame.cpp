@@ -9,6 +9,8 @@
 #include <QDebug>
 #include <QtEndian>
 
+#include "protocol.h"
+
 Frame::Frame(const QByteArray &data)
 {
     read(data);
@@ -25,75 +27,100 @@ Frame::Types Frame::type() const
 
 void Frame::read(const QByteArray &data)
 {
-    QDataStream stream(data);
+    const char *pt = data.constData();
+    const int length = data.length();
+    if (length < int(sizeof(quint32))) {
+        qWarning() << "truncated frame" << data;
+        mType = UNSUPPORTED;
+        return;
+    }
 
-    quint32 type = 0;
-    stream >> type;
-    switch (qFromBigEndian<quint32>(type)) {
+    const quint32 type = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(pt));
+    bool valid = false;
+    switch (type) {
     case PING:
-        mType = PING;
-        readPing(stream);
-        return;
+        valid = Protocol::Ping::decode(pt, length, mPingCount);
+        break;
     case CAPABILITIES:
-        mType = CAPABILITIES;
-        readCapabilities(stream);
-        return;
-    case TRACK_STATE:
-        mType = TRACK_STATE;
-        readTrackState(stream);
-        return;
-    case ACQUIRE_ACK:
-        mType = ACQUIRE_ACK;
-        readAcquireAck(stream);
-        return;
-    case RELEASE_ACK:
-        mType = RELEASE_ACK;
-        readReleaseAck(stream);
-        return;
+        valid = readCapabilities(data);
+        break;
+    case TRACK_STATE: {
+        qint32 isForward, isBackward, speed, position;
+        quint32 count;
+        quint64 time;
+        if (Protocol::StampedTrackState::decode(pt, length, mTrackId, isForward,
+                                                isBackward, speed, count, position, time)) {
+            valid = true;
+            mTimes[0] = qint64(time);
+        } else {
+            valid = Protocol::TrackState::decode(pt, length, mTrackId, isForward,
+                                                 isBackward, speed, count, position);
+        }
+        if (valid)
+            mTrackState = Track::State(isForward, isBackward, speed, count, position);
+        break;
+    }
+    case ACQUIRE_ACK: {
+        quint32 ack = 0;
+        valid = Protocol::AcquireAck::decode(pt, length, mTrackId, ack);
+        mAck = ack;
+        break;
+    }
+    case RELEASE_ACK: {
+        quint32 ack = 0;
+        valid = Protocol::ReleaseAck::decode(pt, length, mTrackId, ack);
+        mAck = ack;
+        break;
+    }
+    case NACK:
+        valid = Protocol::Nack::decode(pt, length, mSequence);
+        break;
+    case TIME_REPLY: {
+        quint64 t1 = 0, t2 = 0, t3 = 0;
+        valid = Protocol::TimeReply::decode(pt, length, t1, t2, t3);
+        mTimes[0] = qint64(t1);
+        mTimes[1] = qint64(t2);
+        mTimes[2] = qint64(t3);
+        break;
+    }
     default:
         qWarning() << "unknown type from frame" << type;
         mType = UNSUPPORTED;
+        return;
+    }
+    if (!valid) {
+        qWarning() << "truncated frame of type" << type;
+        mType = UNSUPPORTED;
+        return;
     }
+    mType = Types(type);
 }
 
-void Frame::readPing(QDataStream &stream)
+bool Frame::readCapabilities(const QByteArray &data)
 {
-    quint64 count;
-    stream >> count;
-    mPingCount = qFromBigEndian<quint64>(count);
-}
+    QDataStream stream(data);
+    stream.skipRawData(sizeof(quint32));
 
-void Frame::readCapabilities(QDataStream &stream)
-{
-    quint32 nTracks;
+    quint32 nTracks = 0;
     stream >> nTracks;
-    for (quint32 i = 0; i < qFromBigEndian<quint32>(nTracks); i++) {
-        mTrackDefinitions.append(Track::Definition(stream));
+    nTracks = qFromBigEndian<quint32>(nTracks);
+    // Stop at the first malformed definition, whatever the announced
+    // number of tracks.
+    for (quint32 i = 0; i < nTracks && stream.status() == QDataStream::Ok; i++) {
+        const Track::Definition definition(stream);
+        if (stream.status() == QDataStream::Ok)
+            mTrackDefinitions.append(definition);
     }
-}
-
-void Frame::readTrackState(QDataStream &stream)
-{
-    quint32 id;
-    stream >> id;
-    mTrackId = qFromBigEndian<quint32>(id);
-    mTrackState = Track::State(stream);
-}
-
-void Frame::readAcquireAck(QDataStream &stream)
-{
-    quint32 id, ack;
-    stream >> id >> ack;
-    mTrackId = qFromBigEndian<quint32>(id);
-    mAck = qFromBigEndian<quint32>(ack);
-}
-
-void Frame::readReleaseAck(QDataStream &stream)
-{
-    quint32 id, ack;
-    stream >> id >> ack;
-    mTrackId = qFromBigEndian<quint32>(id);
-    mAck = qFromBigEndian<quint32>(ack);
+    if (stream.status() != QDataStream::Ok) {
+        qWarning() << "malformed track definitions, kept" << mTrackDefinitions.count();
+        return !mTrackDefinitions.isEmpty();
+    }
+    if (!stream.atEnd()) {
+        quint32 features;
+        stream >> features;
+        mFeatures = qFromBigEndian<quint32>(features);
+    }
+    return true;
 }
 
 QList<Track::Definition> Frame::trackDefinitions() const
@@ -112,50 +139,39 @@ Track::State Frame::trackState(int *id) const
     }
 }
 
-QByteArray Frame::pingResponse() const
+quint64 Frame::pingCount() const
 {
-    QByteArray data;
-    QDataStream stream(&data, QIODevice::WriteOnly);
-
-    stream << qToBigEndian<quint32>(quint32(PING)) << qToBigEndian<quint64>(mPingCount);
-
-    return data;
+    return mPingCount;
 }
 
-QByteArray Frame::acquireFrame(int id)
+bool Frame::ack(int *id) const
 {
-    QByteArray data;
-    QDataStream stream(&data, QIODevice::WriteOnly);
-
-    stream << qToBigEndian<quint32>(quint32(ACQUIRE_TRACK)) << qToBigEndian<quint32>(id);
-
-    return data;
+    if ((mType == ACQUIRE_ACK || mType == RELEASE_ACK) && id)
+        *id = mTrackId;
+    return mAck;
 }
 
-QByteArray Frame::releaseFrame(int id)
+quint32 Frame::features() const
 {
-    QByteArray data;
-    QDataStream stream(&data, QIODevice::WriteOnly);
-
-    stream << qToBigEndian<quint32>(quint32(RELEASE_TRACK)) << qToBigEndian<quint32>(id);
-
-    return data;
+    return mType == CAPABILITIES ? mFeatures : quint32(NO_FEATURE);
 }
 
-bool Frame::ack(int *id) const
+int Frame::nackSequence() const
 {
-    if ((mType == ACQUIRE_ACK || mType == RELEASE_ACK) && id)
-        *id = mTrackId;
-    return mAck;
+    return mType == NACK ? int(mSequence) : -1;
 }
 
-QByteArray Frame::speedFrame(int id, int speed)
+qint64 Frame::deviceTime() const
 {
-    QByteArray data;
-    QDataStream stream(&data, QIODevice::WriteOnly);
-
-    stream << qToBigEndian<quint32>(quint32(SPEED_COMMAND));
-    stream << qToBigEndian<quint32>(id) << qToBigEndian<qint32>(speed);
+    return mType == TRACK_STATE ? mTimes[0] : -1;
+}
 
-    return data;
+bool Frame::timeReply(qint64 *t1, qint64 *t2, qint64 *t3) const
+{
+    if (mType != TIME_REPLY)
+        return false;
+    *t1 = mTimes[0];
+    *t2 = mTimes[1];
+    *t3 = mTimes[2];
+    return true;
 }
@@ -24,7 +24,24 @@ public:
                 ACQUIRE_ACK,
                 RELEASE_TRACK,
                 RELEASE_ACK,
-                SPEED_COMMAND
+                SPEED_COMMAND,
+                PROTOCOL,
+                STATE_REQUEST,
+                NACK,
+                REPORT_INTERVAL,
+                TIME_REQUEST,
+                TIME_REPLY,
+                SCHEDULED_SPEED
+    };
+
+    // Optional protocol features, advertised by the device at the end
+    // of CAPABILITIES and enabled by the station with PROTOCOL.
+    enum Feature {
+                NO_FEATURE = 0,
+                FRAMING     = 1,
+                REPORT_RATE = 2,
+                TIMESTAMPS  = 4,
+                SCHEDULED   = 8
     };
 
     Frame(const QByteArray &data);
@@ -33,20 +50,17 @@ public:
     Types type() const;
     QList<Track::Definition> trackDefinitions() const;
     Track::State trackState(int *id) const;
-    QByteArray pingResponse() const;
+    quint64 pingCount() const;
     bool ack(int *id) const;
-
-    static QByteArray acquireFrame(int id);
-    static QByteArray releaseFrame(int id);
-    static QByteArray speedFrame(int id, int speed);
+    quint32 features() const;
+    int nackSequence() const;
+    // Device time in µs of a TRACK_STATE, -1 when not stamped.
+    qint64 deviceTime() const;
+    bool timeReply(qint64 *t1, qint64 *t2, qint64 *t3) const;
 
 private:
     void read(const QByteArray &data);
-    void readPing(QDataStream &stream);
-    void readCapabilities(QDataStream &stream);
-    void readTrackState(QDataStream &stream);
-    void readAcquireAck(QDataStream &stream);
-    void readReleaseAck(QDataStream &stream);
+    bool readCapabilities(const QByteArray &data);
 
     Types mType = UNSUPPORTED;
     quint64 mPingCount = 0;
@@ -54,6 +68,9 @@ private:
     Track::State mTrackState;
     quint32 mTrackId = 0;
     bool mAck = false;
+    quint32 mFeatures = NO_FEATURE;
+    quint32 mSequence = 0;
+    qint64 mTimes[3] = {-1, -1, -1};
 };
 
 #endif
@@ -0,0 +1,147 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "framing.h"
+
+#include <QDebug>
+#include <QtEndian>
+#include <cstring>
+
+static const char SYNC0 = char(0xA5);
+static const char SYNC1 = char(0x5A);
+static const int HEADER = 6;
+static const int TRAILER = 2;
+
+Framing::Framing()
+    : mSent(WINDOW)
+{
+}
+
+Framing::~Framing()
+{
+}
+
+quint16 Framing::crc(const char *data, int length)
+{
+    // CRC-16/CCITT-FALSE.
+    quint16 crc = 0xFFFF;
+    for (int i = 0; i < length; i++) {
+        crc ^= quint16(quint8(data[i])) << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? quint16((crc << 1) ^ 0x1021) : quint16(crc << 1);
+        }
+    }
+    return crc;
+}
+
+QByteArray Framing::wrap(const char *frame, int length)
+{
+    QByteArray data(HEADER + length + TRAILER, Qt::Uninitialized);
+    char *pt = data.data();
+    pt[0] = SYNC0;
+    pt[1] = SYNC1;
+    qToLittleEndian<quint16>(mTxSequence, reinterpret_cast<uchar*>(pt + 2));
+    qToLittleEndian<quint16>(quint16(length), reinterpret_cast<uchar*>(pt + 4));
+    memcpy(pt + HEADER, frame, length);
+    qToLittleEndian<quint16>(crc(pt + 2, HEADER - 2 + length),
+                             reinterpret_cast<uchar*>(pt + HEADER + length));
+
+    mSent[mTxSequence % WINDOW] = data;
+    mTxSequence += 1;
+    return data;
+}
+
+bool Framing::resend(quint16 from, QByteArray *out) const
+{
+    // Frames from "from" to the last sent one, if they are all still
+    // in the retransmission window.
+    const quint16 count = mTxSequence - from;
+    if (count > WINDOW || count > quint16(mTxSequence - mWindowStart))
+        return false;
+    for (quint16 i = 0; i < count; i++) {
+        out->append(mSent.at((from + i) % WINDOW));
+    }
+    return true;
+}
+
+void Framing::forget()
+{
+    mWindowStart = mTxSequence;
+}
+
+bool Framing::isFramed(const QByteArray &data)
+{
+    return data.length() >= 2 && data.at(0) == SYNC0 && data.at(1) == SYNC1;
+}
+
+void Framing::feed(const QByteArray &data)
+{
+    mInput.append(data);
+}
+
+bool Framing::next(QByteArray *frame)
+{
+    int at = 0;
+    while (true) {
+        at = mInput.indexOf(SYNC0, at);
+        if (at < 0) {
+            mInput.clear();
+            return false;
+        }
+        if (mInput.length() - at < HEADER) {
+            mInput.remove(0, at);
+            return false;
+        }
+        const char *pt = mInput.constData() + at;
+        const quint16 length = qFromLittleEndian<quint16>(reinterpret_cast<const uchar*>(pt + 4));
+        if (pt[1] != SYNC1 || length > MAX_PAYLOAD) {
+            at += 1;
+            continue;
+        }
+        if (mInput.length() - at < HEADER + length + TRAILER) {
+            mInput.remove(0, at);
+            return false;
+        }
+        if (crc(pt + 2, HEADER - 2 + length)
+            != qFromLittleEndian<quint16>(reinterpret_cast<const uchar*>(pt + HEADER + length))) {
+            qWarning() << "corrupted frame, resynchronising";
+            mCorrupted += 1;
+            mResync = true;
+            at += 1;
+            continue;
+        }
+
+        const quint16 sequence = qFromLittleEndian<quint16>(reinterpret_cast<const uchar*>(pt + 2));
+        if (mRxSynced && sequence != mRxSequence) {
+            const quint16 missing = sequence - mRxSequence;
+            qWarning() << "lost" << missing << "frame(s)";
+            mLost += missing;
+            mResync = true;
+        }
+        mRxSynced = true;
+        mRxSequence = sequence + 1;
+        *frame = mInput.mid(at + HEADER, length);
+        mInput.remove(0, at + HEADER + length + TRAILER);
+        return true;
+    }
+}
+
+bool Framing::takeResync()
+{
+    const bool resync = mResync;
+    mResync = false;
+    return resync;
+}
+
+int Framing::lost() const
+{
+    return mLost;
+}
+
+int Framing::corrupted() const
+{
+    return mCorrupted;
+}
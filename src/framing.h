@@ -0,0 +1,57 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <QByteArray>
+#include <QVector>
+
+// Optional envelope around frames, negotiated in CAPABILITIES:
+//   sync (0xA5 0x5A), sequence (u16), length (u16), payload,
+//   CRC-16/CCITT (u16) over sequence, length and payload,
+// all integers in little endian. It allows to detect lost and
+// corrupted frames and to resynchronise on the stream.
+class Framing
+{
+public:
+    Framing();
+    ~Framing();
+
+    static const int MAX_PAYLOAD = 1024;
+    static const int WINDOW = 32;
+
+    QByteArray wrap(const char *frame, int length);
+    bool resend(quint16 from, QByteArray *out) const;
+    // Frames wrapped so far are not resent anymore.
+    void forget();
+
+    // Whether data starts with a frame envelope. Plain frames never
+    // do, their type being small.
+    static bool isFramed(const QByteArray &data);
+
+    void feed(const QByteArray &data);
+    bool next(QByteArray *frame);
+    bool takeResync();
+
+    int lost() const;
+    int corrupted() const;
+
+    static quint16 crc(const char *data, int length);
+
+private:
+    quint16 mTxSequence = 0;
+    quint16 mWindowStart = 0;
+    QVector<QByteArray> mSent;
+    QByteArray mInput;
+    bool mRxSynced = false;
+    quint16 mRxSequence = 0;
+    bool mResync = false;
+    int mLost = 0;
+    int mCorrupted = 0;
+};
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "groupcommand.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSet>
+
+#include "track.h"
+#include "controller.h"
+
+GroupCommand::GroupCommand(QObject *parent)
+    : QObject(parent)
+{
+    mTimer.setSingleShot(true);
+    mTimer.setTimerType(Qt::PreciseTimer);
+    connect(&mTimer, &QTimer::timeout,
+            this, &GroupCommand::dispatch);
+}
+
+GroupCommand::~GroupCommand()
+{
+}
+
+void GroupCommand::addTrack(Track *track)
+{
+    connect(track, &Track::speedChanged,
+            this, [this, track] () {stateChanged(track);});
+    connect(track, &Track::directionChanged,
+            this, [this, track] () {stateChanged(track);});
+}
+
+void GroupCommand::removeTrack(Track *track)
+{
+    QObject::disconnect(track, nullptr, this, nullptr);
+    cancel(track);
+}
+
+void GroupCommand::send(const QList<Track*> &tracks, float speed)
+{
+    mTimer.stop();
+    mImmediate.clear();
+    mStates.clear();
+    mSpeed = speed;
+
+    QList<Track*> scheduled;
+    qint64 roundTrip = 0;
+    for (Track *track : tracks) {
+        Controller *controller = track ? qobject_cast<Controller*>(track->parent()) : nullptr;
+        if (!controller || !track->linked()) {
+            qWarning() << "group command ignores unlinked track" << (track ? track->label() : QString());
+            continue;
+        }
+        const float current = track->direction() == Track::BACKWARD
+            ? -track->speed() : track->speed();
+        if (current != speed)
+            mStates.insert(track, -1);
+        if (controller->supports(Frame::SCHEDULED) && controller->clockSync().synchronized()) {
+            scheduled.append(track);
+            roundTrip = qMax(roundTrip, controller->clockSync().delay());
+        } else {
+            mImmediate.append(track);
+        }
+    }
+    if (scheduled.isEmpty()) {
+        dispatch();
+        return;
+    }
+
+    const qint64 lead = 2 * roundTrip + LEAD;
+    const qint64 at = History::nowUs() + lead;
+    QSet<Controller*> controllers;
+    for (Track *track : scheduled) {
+        Controller *controller = qobject_cast<Controller*>(track->parent());
+        track->commandSpeed(speed, at + controller->clockSync().offset(at));
+        controllers.insert(controller);
+    }
+    for (Controller *controller : controllers) {
+        controller->flush();
+    }
+    qDebug() << "group command scheduled" << lead << "us ahead on" << scheduled.count() << "tracks";
+    if (!mImmediate.isEmpty())
+        mTimer.start(int(lead / 1000));
+}
+
+void GroupCommand::cancel(Track *track)
+{
+    mImmediate.removeAll(track);
+    if (mImmediate.isEmpty())
+        mTimer.stop();
+    mStates.remove(track);
+}
+
+bool GroupCommand::pending() const
+{
+    return mTimer.isActive();
+}
+
+void GroupCommand::dispatch()
+{
+    const QList<QPointer<Track>> tracks = mImmediate;
+    mImmediate.clear();
+
+    // Encode everything first, then write to all links back to back.
+    QList<Controller*> controllers;
+    for (Track *track : tracks) {
+        if (!track)
+            continue;
+        track->commandSpeed(mSpeed);
+        Controller *controller = qobject_cast<Controller*>(track->parent());
+        if (controller && !controllers.contains(controller))
+            controllers.append(controller);
+    }
+    QElapsedTimer elapsed;
+    elapsed.start();
+    for (Controller *controller : controllers) {
+        controller->flush();
+    }
+    mDispatchSkew = int(elapsed.nsecsElapsed() / 1000);
+    qDebug() << "group command written to" << controllers.count() << "devices in"
+             << mDispatchSkew << "us";
+    emit skewChanged();
+}
+
+void GroupCommand::stateChanged(Track *track)
+{
+    QHash<Track*, qint64>::Iterator it = mStates.find(track);
+    if (it == mStates.end() || *it >= 0)
+        return;
+    // Reports in flight and intermediate values are not the command
+    // being applied.
+    const float reported = track->direction() == Track::BACKWARD
+        ? -track->speed() : track->speed();
+    if (qAbs(reported - mSpeed) * track->maxSpeed() > 1.f)
+        return;
+
+    *it = track->stateTime();
+    qint64 first = *it;
+    qint64 last = *it;
+    for (qint64 time : mStates) {
+        if (time < 0)
+            return;
+        first = qMin(first, time);
+        last = qMax(last, time);
+    }
+    // Stamped with device times when available, see ClockSync.
+    mSkew = int(last - first);
+    qDebug() << "group command applied on" << mStates.count() << "tracks with a skew of"
+             << mSkew << "us";
+    mStates.clear();
+    emit skewChanged();
+}
+
+int GroupCommand::dispatchSkew() const
+{
+    return mDispatchSkew;
+}
+
+int GroupCommand::skew() const
+{
+    return mSkew;
+}
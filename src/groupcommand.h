@@ -0,0 +1,66 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GROUPCOMMAND_H
+#define GROUPCOMMAND_H
+
+#include <QObject>
+#include <QTimer>
+#include <QPointer>
+#include <QHash>
+
+class Track;
+
+// Speed changes of several tracks at the same instant, for consists
+// and coordinated departures. Devices supporting SCHEDULED commands
+// apply them at a shared instant in their own clock, the others are
+// sent at that instant, all at once, from here.
+class GroupCommand: public QObject
+{
+    Q_OBJECT
+ public:
+    // Minimum lead, in µs, of scheduled commands, on top of twice the
+    // slowest radio round trip of the group.
+    static const int LEAD = 50000;
+
+    GroupCommand(QObject *parent = nullptr);
+    ~GroupCommand();
+
+    void addTrack(Track *track);
+    void removeTrack(Track *track);
+
+    // A new command supersedes the part of the previous one not sent
+    // yet.
+    void send(const QList<Track*> &tracks, float speed);
+    // Forget track in the command not sent yet. Commands already
+    // scheduled on the device are discarded there by the next
+    // immediate command, like an emergency stop.
+    void cancel(Track *track);
+    bool pending() const;
+
+    // Time, in µs, to write the immediate commands to all links, and
+    // spread of the instants the tracks reached their new speed.
+    int dispatchSkew() const;
+    int skew() const;
+
+ signals:
+    void skewChanged();
+
+ private:
+    void dispatch();
+    void stateChanged(Track *track);
+
+    QTimer mTimer;
+    QList<QPointer<Track>> mImmediate;
+    float mSpeed = 0.;
+    // Tracks of the last command, with the time their reported speed
+    // reached the commanded one, in µs, or -1.
+    QHash<Track*, qint64> mStates;
+    int mDispatchSkew = 0;
+    int mSkew = 0;
+};
+
+#endif
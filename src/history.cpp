@@ -0,0 +1,87 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "history.h"
+
+#include <QElapsedTimer>
+
+History::History(int capacity)
+    : mSamples(qMax(1, capacity))
+{
+}
+
+History::~History()
+{
+}
+
+static QElapsedTimer& clock()
+{
+    static QElapsedTimer timer;
+    if (!timer.isValid())
+        timer.start();
+    return timer;
+}
+
+qint64 History::now()
+{
+    return clock().elapsed();
+}
+
+qint64 History::nowUs()
+{
+    return clock().nsecsElapsed() / 1000;
+}
+
+int History::capacity() const
+{
+    return mSamples.size();
+}
+
+int History::size() const
+{
+    return mSize;
+}
+
+const History::Sample& History::at(int i) const
+{
+    // 0 is the oldest sample.
+    const int start = mHead - mSize + mSamples.size();
+    return mSamples.at((start + i) % mSamples.size());
+}
+
+int History::lowerBound(qint64 time) const
+{
+    // Index of the first sample at or after time.
+    int first = 0;
+    int count = mSize;
+    while (count > 0) {
+        const int step = count / 2;
+        if (at(first + step).mTime < time) {
+            first += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+    return first;
+}
+
+void History::append(qint64 time, float speed, int count)
+{
+    Sample &sample = mSamples[mHead];
+    sample.mTime = time;
+    sample.mSpeed = speed;
+    sample.mCount = count;
+    mHead = (mHead + 1) % mSamples.size();
+    if (mSize < mSamples.size())
+        mSize += 1;
+}
+
+void History::clear()
+{
+    mHead = 0;
+    mSize = 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <QVector>
+
+// A fixed capacity ring buffer of timestamped track samples. The
+// storage is allocated once, appending never allocates.
+class History
+{
+public:
+    struct Sample
+    {
+        qint64 mTime = 0;
+        float mSpeed = 0.;
+        int mCount = 0;
+    };
+
+    History(int capacity = 4096);
+    ~History();
+
+    // Monotonic time, in ms, used to stamp samples, and the same
+    // clock in µs.
+    static qint64 now();
+    static qint64 nowUs();
+
+    int capacity() const;
+    int size() const;
+    const Sample& at(int i) const;
+    int lowerBound(qint64 time) const;
+
+    void append(qint64 time, float speed, int count);
+    void clear();
+
+private:
+    QVector<Sample> mSamples;
+    int mHead = 0;
+    int mSize = 0;
+};
+
+#endif
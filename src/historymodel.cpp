@@ -0,0 +1,238 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "historymodel.h"
+
+#include "history.h"
+
+HistoryModel::HistoryModel(QObject *parent)
+    : QAbstractListModel(parent)
+    , mBuckets(100)
+    , mPrevious(100)
+{
+    connect(&mTimer, &QTimer::timeout,
+            this, &HistoryModel::refresh);
+}
+
+HistoryModel::~HistoryModel()
+{
+}
+
+Track* HistoryModel::track() const
+{
+    return mTrack.data();
+}
+
+void HistoryModel::setTrack(Track *track)
+{
+    if (track == mTrack)
+        return;
+
+    if (mTrack)
+        QObject::disconnect(mTrack.data(), nullptr, this, nullptr);
+    mTrack = track;
+    if (mTrack)
+        connect(mTrack.data(), &Track::historyChanged,
+                this, [this] () {if (mActive) addSample();});
+    updateTimer();
+    refresh();
+    emit trackChanged();
+}
+
+int HistoryModel::duration() const
+{
+    return mDuration;
+}
+
+void HistoryModel::setDuration(int duration)
+{
+    duration = qMax(1, duration);
+    if (duration == mDuration)
+        return;
+
+    mDuration = duration;
+    updateTimer();
+    refresh();
+    emit durationChanged();
+}
+
+int HistoryModel::resolution() const
+{
+    return mBuckets.size();
+}
+
+void HistoryModel::setResolution(int resolution)
+{
+    resolution = qMax(1, resolution);
+    if (resolution == mBuckets.size())
+        return;
+
+    beginResetModel();
+    mBuckets.resize(resolution);
+    mPrevious.resize(resolution);
+    endResetModel();
+    updateTimer();
+    refresh();
+    emit resolutionChanged();
+}
+
+bool HistoryModel::active() const
+{
+    return mActive;
+}
+
+void HistoryModel::setActive(bool active)
+{
+    if (active == mActive)
+        return;
+
+    mActive = active;
+    updateTimer();
+    if (mActive)
+        refresh();
+    emit activeChanged();
+}
+
+void HistoryModel::updateTimer()
+{
+    // One tick per bucket, the window moving by a whole bucket.
+    mTimer.setInterval(qMax(1, mDuration / mBuckets.size()));
+    if (mActive && mTrack)
+        mTimer.start();
+    else
+        mTimer.stop();
+}
+
+int HistoryModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : mBuckets.size();
+}
+
+QVariant HistoryModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= mBuckets.size())
+        return QVariant();
+
+    const Bucket &bucket = mBuckets.at(index.row());
+    switch (role) {
+    case TimeRole:
+        // Start of the bucket, in ms before now.
+        return qint64(index.row() - mBuckets.size()) * mDuration / mBuckets.size();
+    case MinSpeedRole:
+        return bucket.mMin;
+    case MaxSpeedRole:
+        return bucket.mMax;
+    case CountRole:
+        return bucket.mCount;
+    case ValidRole:
+        return bucket.mValid;
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> HistoryModel::roleNames() const
+{
+    QHash<int, QByteArray> roles;
+    roles.insert(TimeRole, "time");
+    roles.insert(MinSpeedRole, "minSpeed");
+    roles.insert(MaxSpeedRole, "maxSpeed");
+    roles.insert(CountRole, "count");
+    roles.insert(ValidRole, "valid");
+    return roles;
+}
+
+bool HistoryModel::Bucket::operator==(const Bucket &other) const
+{
+    return mValid == other.mValid && mCount == other.mCount
+        && mMin == other.mMin && mMax == other.mMax;
+}
+
+void HistoryModel::Bucket::add(const History::Sample &sample)
+{
+    if (mValid) {
+        mMin = qMin(mMin, sample.mSpeed);
+        mMax = qMax(mMax, sample.mSpeed);
+    } else {
+        mMin = mMax = sample.mSpeed;
+        mValid = true;
+    }
+    mCount = sample.mCount;
+}
+
+void HistoryModel::addSample()
+{
+    if (!mTrack || mTrack->history().size() == 0)
+        return;
+
+    // A new sample normally falls in the current, last, bucket. The
+    // window moved otherwise, rebucket it all.
+    const History &history = mTrack->history();
+    const History::Sample &sample = history.at(history.size() - 1);
+    const int last = mBuckets.size() - 1;
+    if ((sample.mTime - mStart) / mWidth != last) {
+        refresh();
+        return;
+    }
+    Bucket &current = mBuckets[last];
+    const Bucket previous = current;
+    current.add(sample);
+    if (!(current == previous))
+        emit dataChanged(index(last), index(last));
+}
+
+void HistoryModel::refresh()
+{
+    // Both vectors are preallocated, swapping them does not allocate.
+    mPrevious.swap(mBuckets);
+    for (Bucket &bucket : mBuckets) {
+        bucket = Bucket();
+    }
+    if (mTrack) {
+        const History &history = mTrack->history();
+        const int n = mBuckets.size();
+        // Bucket boundaries are kept on multiples of their width, so
+        // that a refresh within a bucket does not shift them.
+        const qint64 width = qMax(qint64(1), qint64(mDuration) / n);
+        const qint64 start = (History::now() / width + 1 - n) * width;
+        mStart = start;
+        mWidth = width;
+
+        // A speed holds until the next sample, so a bucket starts
+        // with the last value of the previous ones.
+        Bucket carried;
+        int filled = 0;
+        for (int i = qMax(0, history.lowerBound(start) - 1); i < history.size(); i++) {
+            const History::Sample &sample = history.at(i);
+            if (sample.mTime >= start) {
+                const int at = qMin(n - 1, int((sample.mTime - start) / width));
+                for (; filled < at; filled++) {
+                    if (!mBuckets[filled].mValid)
+                        mBuckets[filled] = carried;
+                }
+                Bucket &current = mBuckets[at];
+                if (!current.mValid)
+                    current = carried;
+                current.add(sample);
+            }
+            carried.mMin = carried.mMax = sample.mSpeed;
+            carried.mCount = sample.mCount;
+            carried.mValid = true;
+        }
+        for (; filled < n; filled++) {
+            if (!mBuckets[filled].mValid)
+                mBuckets[filled] = carried;
+        }
+    }
+    int first = 0;
+    while (first < mBuckets.size() && mBuckets.at(first) == mPrevious.at(first))
+        first++;
+    int last = mBuckets.size() - 1;
+    while (last > first && mBuckets.at(last) == mPrevious.at(last))
+        last--;
+    if (first <= last)
+        emit dataChanged(index(first), index(last));
+}
@@ -0,0 +1,91 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HISTORYMODEL_H
+#define HISTORYMODEL_H
+
+#include <QAbstractListModel>
+#include <QPointer>
+#include <QVector>
+#include <QTimer>
+
+#include "track.h"
+#include "history.h"
+
+// Downsample the history of a track into a fixed number of time
+// buckets, keeping the minimum and maximum speed of each bucket.
+// While active, the window slides with time, one bucket at a time,
+// and new samples only update the current bucket.
+class HistoryModel: public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(Track* track READ track WRITE setTrack NOTIFY trackChanged)
+    Q_PROPERTY(int duration READ duration WRITE setDuration NOTIFY durationChanged)
+    Q_PROPERTY(int resolution READ resolution WRITE setResolution NOTIFY resolutionChanged)
+    Q_PROPERTY(bool active READ active WRITE setActive NOTIFY activeChanged)
+
+ public:
+    enum Roles {
+        TimeRole = Qt::UserRole + 1,
+        MinSpeedRole,
+        MaxSpeedRole,
+        CountRole,
+        ValidRole
+    };
+
+    HistoryModel(QObject *parent = nullptr);
+    ~HistoryModel();
+
+    Track* track() const;
+    void setTrack(Track *track);
+    int duration() const;
+    void setDuration(int duration);
+    int resolution() const;
+    void setResolution(int resolution);
+    // Whether the model is displayed, to slide the window and follow
+    // new samples only then. Off by default, the view showing the
+    // model turns it on.
+    bool active() const;
+    void setActive(bool active);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+ signals:
+    void trackChanged();
+    void durationChanged();
+    void resolutionChanged();
+    void activeChanged();
+
+ private:
+    struct Bucket
+    {
+        float mMin = 0.;
+        float mMax = 0.;
+        int mCount = 0;
+        bool mValid = false;
+        void add(const History::Sample &sample);
+        bool operator==(const Bucket &other) const;
+    };
+
+    void addSample();
+    void refresh();
+    void updateTimer();
+
+    QPointer<Track> mTrack;
+    int mDuration = 300000;
+    QVector<Bucket> mBuckets;
+    // The buckets before the last refresh, to notify changed rows.
+    QVector<Bucket> mPrevious;
+    // Time of the first bucket and bucket width, in ms.
+    qint64 mStart = 0;
+    qint64 mWidth = 1;
+    bool mActive = false;
+    QTimer mTimer;
+};
+
+#endif
@@ -0,0 +1,389 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "hub.h"
+
+#include <QDebug>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QtEndian>
+
+#include "track.h"
+
+// Labels longer than this are truncated on the wire.
+static const int MAX_LABEL = 1024;
+
+Hub::Hub(QObject *parent)
+    : QObject(parent)
+{
+    connect(&mServer, &QLocalServer::newConnection,
+            this, &Hub::newConnection);
+}
+
+Hub::~Hub()
+{
+    close();
+}
+
+bool Hub::listen(const QString &name)
+{
+    if (mServer.isListening())
+        return true;
+
+    // The socket of a crashed instance is removed, the one of a
+    // running instance is left alone.
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if (probe.waitForConnected(100)) {
+        qWarning() << "hub" << name << "is served by another instance";
+        probe.abort();
+        return false;
+    }
+    QLocalServer::removeServer(name);
+    if (!mServer.listen(name)) {
+        qWarning() << "cannot start hub on" << name << mServer.errorString();
+        return false;
+    }
+    qDebug() << "hub listening on" << mServer.fullServerName();
+    return true;
+}
+
+void Hub::close()
+{
+    mServer.close();
+    const QList<QLocalSocket*> sockets = mClients.keys();
+    for (QLocalSocket *socket : sockets) {
+        clientGone(socket);
+        socket->abort();
+        socket->deleteLater();
+    }
+}
+
+bool Hub::isListening() const
+{
+    return mServer.isListening();
+}
+
+int Hub::clients() const
+{
+    return mClients.count();
+}
+
+void Hub::addTrack(Track *track)
+{
+    if (mEntries.contains(track))
+        return;
+
+    Entry entry;
+    entry.mIndex = mNextIndex++;
+    entry.mDirty = true;
+    mEntries.insert(track, entry);
+    mTracks.insert(entry.mIndex, track);
+    mSnapshot.clear();
+    connect(track, &Track::directionChanged,
+            this, [this, track] () {changed(track);});
+    connect(track, &Track::speedChanged,
+            this, [this, track] () {changed(track);});
+    connect(track, &Track::countChanged,
+            this, [this, track] () {changed(track);});
+    connect(track, &Track::positionChanged,
+            this, [this, track] () {changed(track);});
+    connect(track, &Track::linkedChanged,
+            this, [this, track] () {changed(track);});
+    connect(track, &QObject::destroyed,
+            this, [this, track] () {removeTrack(track);});
+
+    // Connected clients learn about the new track through a new
+    // snapshot, definitions are not part of the delta stream.
+    for (QHash<QLocalSocket*, Client>::Iterator it = mClients.begin();
+         it != mClients.end(); ++it) {
+        sendSnapshot(it.key(), it.value());
+    }
+}
+
+void Hub::removeTrack(Track *track)
+{
+    QHash<Track*, Entry>::Iterator entry = mEntries.find(track);
+    if (entry == mEntries.end())
+        return;
+
+    QObject::disconnect(track, nullptr, this, nullptr);
+    mTracks.remove(entry->mIndex);
+    mRemoved.append(entry->mIndex);
+    mEntries.erase(entry);
+    mSnapshot.clear();
+    if (!mBroadcastScheduled) {
+        mBroadcastScheduled = true;
+        QTimer::singleShot(0, this, &Hub::broadcast);
+    }
+}
+
+bool Hub::requestSpeed(Track *track, float speed)
+{
+    const quint32 owner = mEntries.value(track).mOwner;
+    if (owner) {
+        qWarning() << "local speed request on" << track->label()
+                   << "refused, owned by hub client" << owner;
+        return false;
+    }
+    track->requestSpeed(speed);
+    return true;
+}
+
+float Hub::sampleFanout(int interval)
+{
+    mFanout = interval > 0
+        ? float(mTraffic - mSampledTraffic) * 1000. / interval : 0.;
+    mSampledTraffic = mTraffic;
+    return mFanout;
+}
+
+float Hub::fanout() const
+{
+    return mFanout;
+}
+
+void Hub::newConnection()
+{
+    while (QLocalSocket *socket = mServer.nextPendingConnection()) {
+        Client &client = mClients[socket];
+        client.mId = mNextClient++;
+        connect(socket, &QLocalSocket::readyRead,
+                this, [this, socket] () {readClient(socket);});
+        connect(socket, &QLocalSocket::bytesWritten,
+                this, [this, socket] () {bytesWritten(socket);});
+        connect(socket, &QLocalSocket::disconnected,
+                this, [this, socket] () {
+                    clientGone(socket);
+                    socket->deleteLater();
+                });
+        qDebug() << "hub client" << client.mId << "connected," << mClients.count() << "clients";
+        sendSnapshot(socket, client);
+        emit clientsChanged();
+    }
+}
+
+void Hub::clientGone(QLocalSocket *socket)
+{
+    QHash<QLocalSocket*, Client>::Iterator client = mClients.find(socket);
+    if (client == mClients.end())
+        return;
+
+    // Stop the trains of a client that went away, nobody drives them.
+    const quint32 id = client->mId;
+    mClients.erase(client);
+    QObject::disconnect(socket, nullptr, this, nullptr);
+    for (QHash<Track*, Entry>::Iterator it = mEntries.begin(); it != mEntries.end(); ++it) {
+        if (it->mOwner == id) {
+            it->mOwner = 0;
+            it.key()->requestSpeed(0.);
+            changed(it.key());
+        }
+    }
+    qDebug() << "hub client" << id << "disconnected," << mClients.count() << "clients";
+    emit clientsChanged();
+}
+
+void Hub::readClient(QLocalSocket *socket)
+{
+    while (socket->bytesAvailable() >= qint64(sizeof(quint32))) {
+        quint32 type;
+        socket->peek(reinterpret_cast<char*>(&type), sizeof(quint32));
+        type = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(&type));
+        int size = 0;
+        switch (type) {
+        case ACQUIRE:
+            size = Acquire::SIZE;
+            break;
+        case RELEASE:
+            size = Release::SIZE;
+            break;
+        case SPEED:
+            size = Speed::SIZE;
+            break;
+        default:
+            qWarning() << "hub client sent an unknown message" << type;
+            clientGone(socket);
+            socket->disconnectFromServer();
+            socket->deleteLater();
+            return;
+        }
+        if (socket->bytesAvailable() < size)
+            return;
+        readMessage(socket, socket->read(size));
+    }
+}
+
+void Hub::readMessage(QLocalSocket *socket, const QByteArray &message)
+{
+    QHash<QLocalSocket*, Client>::Iterator client = mClients.find(socket);
+    if (client == mClients.end())
+        return;
+
+    quint32 index;
+    qint32 speed = 0;
+    Types type;
+    if (Acquire::decode(message.constData(), message.length(), index)) {
+        type = ACQUIRE;
+    } else if (Release::decode(message.constData(), message.length(), index)) {
+        type = RELEASE;
+    } else if (Speed::decode(message.constData(), message.length(), index, speed)) {
+        type = SPEED;
+    } else {
+        return;
+    }
+    Track *track = mTracks.value(index, nullptr);
+    if (!track)
+        return;
+
+    // First come, first served: a track owned by another client is
+    // left untouched and the requester gets its current state back.
+    Entry &entry = mEntries[track];
+    if (entry.mOwner && entry.mOwner != client->mId) {
+        qDebug() << "hub client" << client->mId << "denied track" << track->label()
+                 << "owned by" << entry.mOwner;
+        QByteArray state;
+        appendState(state, track);
+        write(socket, client.value(), state);
+        return;
+    }
+    switch (type) {
+    case ACQUIRE:
+        entry.mOwner = client->mId;
+        if (!track->linked())
+            track->acquire();
+        changed(track);
+        break;
+    case RELEASE:
+        entry.mOwner = 0;
+        changed(track);
+        break;
+    case SPEED:
+        if (speed < -SPEED_SCALE || speed > SPEED_SCALE) {
+            qWarning() << "hub client" << client->mId << "sent an out of range speed"
+                       << speed << "for" << track->label();
+            speed = qBound(-SPEED_SCALE, speed, int(SPEED_SCALE));
+        }
+        if (entry.mOwner == client->mId)
+            track->requestSpeed(float(speed) / SPEED_SCALE);
+        break;
+    default:
+        break;
+    }
+}
+
+void Hub::bytesWritten(QLocalSocket *socket)
+{
+    QHash<QLocalSocket*, Client>::Iterator client = mClients.find(socket);
+    if (client == mClients.end() || !client->mLagging || socket->bytesToWrite() > 0)
+        return;
+
+    qDebug() << "hub client" << client->mId << "caught up, sending a new snapshot";
+    sendSnapshot(socket, client.value());
+}
+
+void Hub::changed(Track *track)
+{
+    QHash<Track*, Entry>::Iterator entry = mEntries.find(track);
+    if (entry == mEntries.end())
+        return;
+
+    mSnapshot.clear();
+    entry->mDirty = true;
+    if (!mBroadcastScheduled) {
+        mBroadcastScheduled = true;
+        QTimer::singleShot(0, this, &Hub::broadcast);
+    }
+}
+
+void Hub::broadcast()
+{
+    mBroadcastScheduled = false;
+
+    // All changes of the event loop turn are encoded once, then
+    // copied to the write buffer of every client.
+    QByteArray delta;
+    for (quint32 index : mRemoved) {
+        Removed::Buffer buffer;
+        delta.append(buffer, Removed::encode(buffer, index));
+    }
+    mRemoved.clear();
+    for (Track *track : mTracks) {
+        Entry &entry = mEntries[track];
+        if (entry.mDirty) {
+            appendState(delta, track);
+            entry.mDirty = false;
+        }
+    }
+    if (delta.isEmpty() || mClients.isEmpty())
+        return;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    for (QHash<QLocalSocket*, Client>::Iterator it = mClients.begin();
+         it != mClients.end(); ++it) {
+        write(it.key(), it.value(), delta);
+    }
+    qDebug() << "hub delta of" << delta.length() << "bytes to" << mClients.count()
+             << "clients in" << elapsed.nsecsElapsed() / 1000 << "us";
+}
+
+const QByteArray& Hub::snapshot()
+{
+    if (mSnapshot.isEmpty()) {
+        for (Track *track : mTracks) {
+            appendDefinition(mSnapshot, track);
+            appendState(mSnapshot, track);
+        }
+    }
+    return mSnapshot;
+}
+
+void Hub::appendDefinition(QByteArray &data, Track *track) const
+{
+    const QByteArray label = track->label().toUtf8().left(MAX_LABEL);
+    Definition::Buffer buffer;
+    data.append(buffer, Definition::encode(buffer, mEntries.value(track).mIndex,
+                                           quint32(track->capabilities()),
+                                           quint32(label.length())));
+    data.append(label);
+}
+
+void Hub::appendState(QByteArray &data, Track *track) const
+{
+    const Entry entry = mEntries.value(track);
+    State::Buffer buffer;
+    data.append(buffer, State::encode(buffer, entry.mIndex, qint32(track->direction()),
+                                      qint32(track->speed() * SPEED_SCALE),
+                                      quint32(track->count()),
+                                      qint32(track->position()),
+                                      quint32(track->linked()), entry.mOwner));
+}
+
+void Hub::write(QLocalSocket *socket, Client &client, const QByteArray &data)
+{
+    if (client.mLagging)
+        return;
+    if (socket->bytesToWrite() > CLIENT_BACKLOG) {
+        // Deltas are idempotent, the client gets a fresh snapshot
+        // instead of an ever growing backlog.
+        qWarning() << "hub client" << client.mId << "is lagging behind,"
+                   << socket->bytesToWrite() << "bytes buffered";
+        client.mLagging = true;
+        return;
+    }
+    mTraffic += data.length();
+    socket->write(data);
+}
+
+void Hub::sendSnapshot(QLocalSocket *socket, Client &client)
+{
+    client.mLagging = false;
+    write(socket, client, snapshot());
+    SnapshotEnd::Buffer buffer;
+    write(socket, client, QByteArray(buffer, SnapshotEnd::encode(buffer, quint32(mTracks.count()),
+                                                                  client.mId)));
+}
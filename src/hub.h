@@ -0,0 +1,127 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HUB_H
+#define HUB_H
+
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QHash>
+#include <QMap>
+#include <QByteArray>
+
+#include "codec.h"
+
+class Track;
+
+// Shares the tracks of this station with local clients over a Unix
+// socket. A client first receives a snapshot, one DEFINITION and one
+// STATE message per track followed by SNAPSHOT_END, then a stream of
+// STATE and REMOVED deltas. Clients drive a track after acquiring it,
+// a track is owned by at most one client at a time.
+class Hub: public QObject
+{
+    Q_OBJECT
+ public:
+    enum Types
+        {
+         DEFINITION = 0x100,
+         STATE,
+         REMOVED,
+         SNAPSHOT_END,
+         ACQUIRE,
+         RELEASE,
+         SPEED
+        };
+
+    // Speeds are exchanged in fractions of the track maximum speed.
+    static const int SPEED_SCALE = 10000;
+    // Bytes buffered for a client above which it is considered lagging:
+    // deltas are not queued anymore and a new snapshot is sent once
+    // its buffer is drained.
+    static const int CLIENT_BACKLOG = 16384;
+
+    // index, capabilities, label length, followed by the UTF-8 label
+    typedef Codec::Message<DEFINITION, quint32, quint32, quint32> Definition;
+    // index, direction, speed, count, position, linked, owner
+    typedef Codec::Message<STATE, quint32, qint32, qint32, quint32,
+                           qint32, quint32, quint32> State;
+    // index
+    typedef Codec::Message<REMOVED, quint32> Removed;
+    // number of tracks, client id
+    typedef Codec::Message<SNAPSHOT_END, quint32, quint32> SnapshotEnd;
+    // index
+    typedef Codec::Message<ACQUIRE, quint32> Acquire;
+    // index
+    typedef Codec::Message<RELEASE, quint32> Release;
+    // index, signed speed
+    typedef Codec::Message<SPEED, quint32, qint32> Speed;
+
+    Hub(QObject *parent = nullptr);
+    ~Hub();
+
+    bool listen(const QString &name);
+    void close();
+    bool isListening() const;
+    int clients() const;
+
+    void addTrack(Track *track);
+    void removeTrack(Track *track);
+
+    // Speed request from the station itself, refused while a client
+    // owns the track.
+    bool requestSpeed(Track *track, float speed);
+
+    // Bytes handed to the client sockets since the last sample, per
+    // second, the interval being in milliseconds.
+    float sampleFanout(int interval);
+    float fanout() const;
+
+ signals:
+    void clientsChanged();
+
+ private:
+    struct Entry
+    {
+        quint32 mIndex = 0;
+        quint32 mOwner = 0;
+        bool mDirty = false;
+    };
+    struct Client
+    {
+        quint32 mId = 0;
+        bool mLagging = false;
+    };
+
+    void newConnection();
+    void clientGone(QLocalSocket *socket);
+    void readClient(QLocalSocket *socket);
+    void readMessage(QLocalSocket *socket, const QByteArray &message);
+    void bytesWritten(QLocalSocket *socket);
+    void changed(Track *track);
+    void broadcast();
+    const QByteArray& snapshot();
+    void appendDefinition(QByteArray &data, Track *track) const;
+    void appendState(QByteArray &data, Track *track) const;
+    void write(QLocalSocket *socket, Client &client, const QByteArray &data);
+    void sendSnapshot(QLocalSocket *socket, Client &client);
+
+    QLocalServer mServer;
+    QHash<QLocalSocket*, Client> mClients;
+    quint32 mNextClient = 1;
+    QHash<Track*, Entry> mEntries;
+    QMap<quint32, Track*> mTracks;
+    quint32 mNextIndex = 0;
+    QList<quint32> mRemoved;
+    QByteArray mSnapshot;
+    bool mBroadcastScheduled = false;
+    qint64 mTraffic = 0;
+    qint64 mSampledTraffic = 0;
+    float mFanout = 0.;
+};
+
+#endif
@@ -7,13 +7,15 @@
 #include "interconnect.h"
 
 #include <QDebug>
-#include <QDateTime>
 #include <BluezQt/InitManagerJob>
 #include <BluezQt/Adapter>
 #include <BluezQt/Device>
 #include <BluezQt/PendingCall>
 
 #include "spp.h"
+#include "controller.h"
+
+const QString InterConnect::HUB_NAME = QStringLiteral("train-station");
 
 static InterConnect *singleton = nullptr;
 QObject* InterConnect::instance(QQmlEngine *e, QJSEngine *js)
@@ -31,8 +33,34 @@ InterConnect::InterConnect(QObject *parent)
     job->start();
     connect(job, &BluezQt::InitManagerJob::result,
             this, &InterConnect::initialized);
-    mPingTimer.setInterval(3000);
-    connect(&mPingTimer, &QTimer::timeout, this, &InterConnect::checkPing);
+    connect(&mStation, &Station::devicesChanged,
+            this, &InterConnect::devicesChanged);
+    connect(&mStation, &Station::tracksChanged,
+            this, &InterConnect::tracksChanged);
+    connect(&mStation, &Station::stopLatencyChanged,
+            this, &InterConnect::stopLatencyChanged);
+    connect(&mStation, &Station::idleChanged,
+            this, &InterConnect::idleChanged);
+    connect(&mStation, &Station::idleChanged,
+            this, &InterConnect::updateDiscovery);
+    connect(&mStation, &Station::wakeupsChanged,
+            this, &InterConnect::wakeupsChanged);
+    connect(mStation.hub(), &Hub::clientsChanged,
+            this, &InterConnect::hubClientsChanged);
+    connect(mStation.group(), &GroupCommand::skewChanged,
+            this, &InterConnect::groupSkewChanged);
+    connect(&mStation, &Station::unresponsive,
+            this, [this] (Controller *controller) {
+                disconnect(linkedDevice(controller->address()));
+            });
+    connect(&mStation, &Station::checked,
+            this, &InterConnect::balance);
+    connect(&mStation, &Station::reconnect,
+            this, [this] (const QString &address) {
+                BluezQt::DevicePtr device = deviceForAddress(address);
+                if (device)
+                    autoConnect(device);
+            });
 }
 
 InterConnect::~InterConnect()
@@ -44,60 +72,96 @@ void InterConnect::initialized(BluezQt::InitManagerJob *job)
     job->deleteLater();
 
     Spp *spp = new Spp(QString(), this);
-    connect(spp, &Spp::frameAvailable,
-            this, &InterConnect::readFrame);
     connect(spp, &Spp::connected,
-            [this] (const QString &device, const QString &name) {
-                qDebug() << "profile connected" << device << name;
-                mDevices.append(name);
-                emit devicesChanged();
-                mDevicesByAddress.append(device);
-                mAliveDevices.insert(device);
-                mPingTimer.start();
-            });
+            this, &InterConnect::addController);
     connect(spp, &Spp::disconnected,
-            [this] (const QString &device, const QString &name) {
-                qDebug() << "profile disconnected" << device << name;
-                if (mDevicesByAddress.contains(device)) {
-                    mDevicesByAddress.removeAll(device);
-                    mDevices.removeAll(name);
-                    emit devicesChanged();
-                    for (const QString &key : mTracks.keys()) {
-                        if (key.startsWith(device)) {
-                            mTracks.remove(key);
-                        }
-                    }
-                    emit tracksChanged();
-                    mDeadDevices.insert(device);
-                }
-            });
+            this, &InterConnect::removeController);
     registerProfile(spp);
+    mSpp = spp;
     mSppUuid = spp->uuid();
 
-    BluezQt::AdapterPtr adapter = usableAdapter();
-    if (!adapter) {
+    connect(this, &BluezQt::Manager::adapterAdded,
+            this, [this] (BluezQt::AdapterPtr adapter) {
+                if (adapter->isPowered()) {
+                    qDebug() << "found an adapter, starting discovery.";
+                    scan(adapter);
+                }
+            });
+    connect(this, &BluezQt::Manager::adapterChanged,
+            this, [this] (BluezQt::AdapterPtr adapter) {
+                if (adapter->isPowered()) {
+                    scan(adapter);
+                } else {
+                    forgetAdapter(adapter);
+                }
+            });
+    connect(this, &BluezQt::Manager::adapterRemoved,
+            this, &InterConnect::forgetAdapter);
+    for (BluezQt::AdapterPtr adapter : adapters()) {
+        if (adapter->isPowered()) {
+            scan(adapter);
+        }
+    }
+    if (mAdapterLoads.isEmpty()) {
         qDebug() << "no powered adapter";
-        connect(this, &BluezQt::Manager::adapterAdded,
-                [this] (BluezQt::AdapterPtr adapter) {
-                    if (adapter->isPowered()) {
-                        qDebug() << "found an adapter, starting discovery.";
-                        scan(adapter);
-                    }
-                });
-        connect(this, &BluezQt::Manager::adapterChanged,
-                [this] (BluezQt::AdapterPtr adapter) {
-                    if (adapter->isPowered()) {
-                        qDebug() << "adapter is powered, starting discovery.";
-                        scan(adapter);
-                    }
-                });
-    } else {
-        scan(adapter);
+    }
+}
+
+void InterConnect::addController(Controller *controller)
+{
+    qDebug() << "profile connected" << controller->address() << controller->name()
+             << "on" << controller->adapter();
+    // A link may complete after its adapter was powered off, it is
+    // then counted when the adapter is scanned again.
+    QHash<QString, AdapterLoad>::Iterator load = mAdapterLoads.find(controller->adapter());
+    if (load != mAdapterLoads.end())
+        load->mLinks += 1;
+    mMoves.remove(controller->address());
+    mStation.addController(controller);
+}
+
+void InterConnect::removeController(Controller *controller)
+{
+    qDebug() << "profile disconnected" << controller->address() << controller->name();
+    if (!mStation.controller(controller->address()))
+        return;
+
+    QHash<QString, AdapterLoad>::Iterator load = mAdapterLoads.find(controller->adapter());
+    if (load != mAdapterLoads.end())
+        load->mLinks -= 1;
+    mStation.removeController(controller);
+}
+
+void InterConnect::updateDiscovery()
+{
+    // Nothing moves: stop discovery, the known devices reconnect
+    // without it.
+    const bool idle = mStation.idle();
+    for (QHash<QString, AdapterLoad>::ConstIterator it = mAdapterLoads.constBegin();
+         it != mAdapterLoads.constEnd(); ++it) {
+        BluezQt::AdapterPtr adapter = adapterForAddress(it.key());
+        if (!adapter)
+            continue;
+        if (idle && adapter->isDiscovering()) {
+            adapter->stopDiscovery();
+        } else if (!idle && !adapter->isDiscovering()) {
+            adapter->startDiscovery();
+        }
     }
 }
 
 void InterConnect::scan(BluezQt::AdapterPtr adapter)
 {
+    if (mAdapterLoads.contains(adapter->address()))
+        return;
+
+    qDebug() << "adapter" << adapter->address() << "is powered, starting discovery.";
+    AdapterLoad load;
+    for (Controller *controller : mStation.controllers()) {
+        if (controller->adapter() == adapter->address())
+            load.mLinks += 1;
+    }
+    mAdapterLoads.insert(adapter->address(), load);
     connect(adapter.data(), &BluezQt::Adapter::deviceAdded,
             this, &InterConnect::autoConnect);
     connect(adapter.data(), &BluezQt::Adapter::deviceRemoved,
@@ -108,14 +172,119 @@ void InterConnect::scan(BluezQt::AdapterPtr adapter)
     }
 }
 
+void InterConnect::forgetAdapter(BluezQt::AdapterPtr adapter)
+{
+    if (!mAdapterLoads.contains(adapter->address()))
+        return;
+
+    qDebug() << "adapter" << adapter->address() << "is gone.";
+    QObject::disconnect(adapter.data(), nullptr, this, nullptr);
+    // Its links are dead, drop them so that the station reconnects
+    // the devices through another adapter.
+    QStringList lost;
+    for (Controller *controller : mStation.controllers()) {
+        if (controller->adapter() == adapter->address())
+            lost.append(controller->address());
+    }
+    for (const QString &address : lost) {
+        if (mSpp)
+            mSpp->drop(address);
+    }
+    mAdapterLoads.remove(adapter->address());
+}
+
+BluezQt::DevicePtr InterConnect::pickDevice(const QString &address) const
+{
+    // The same controller is seen once per adapter in range. Prefer
+    // the adapter it is being moved to, if any, then the least
+    // loaded one, counting one unit per link plus the used ratio of
+    // the adapter bandwidth.
+    const QString preferred = mMoves.value(address);
+    BluezQt::DevicePtr best;
+    float bestScore = 0.;
+    for (BluezQt::AdapterPtr adapter : adapters()) {
+        if (!adapter->isPowered())
+            continue;
+        BluezQt::DevicePtr device = adapter->deviceForAddress(address);
+        if (!device)
+            continue;
+        if (adapter->address() == preferred)
+            return device;
+        const AdapterLoad load = mAdapterLoads.value(adapter->address());
+        const float score = load.mLinks + load.mThroughput / mAdapterCapacity;
+        if (!best || score < bestScore) {
+            best = device;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+BluezQt::DevicePtr InterConnect::linkedDevice(const QString &address) const
+{
+    Controller *controller = mStation.controller(address);
+    BluezQt::AdapterPtr adapter = controller ? adapterForAddress(controller->adapter()) : BluezQt::AdapterPtr();
+    BluezQt::DevicePtr device = adapter ? adapter->deviceForAddress(address) : BluezQt::DevicePtr();
+    return device ? device : deviceForAddress(address);
+}
+
+void InterConnect::balance()
+{
+    for (AdapterLoad &load : mAdapterLoads) {
+        load.mThroughput = 0.;
+    }
+    for (Controller *controller : mStation.controllers()) {
+        const float throughput = controller->throughput();
+        QHash<QString, AdapterLoad>::Iterator load = mAdapterLoads.find(controller->adapter());
+        if (load != mAdapterLoads.end())
+            load->mThroughput += throughput;
+    }
+
+    // Move the busiest device of each saturated adapter to the least
+    // loaded adapter that can reach it. It is disconnected here and
+    // reconnected on the next check, see Station::reconnect().
+    for (QHash<QString, AdapterLoad>::ConstIterator it = mAdapterLoads.constBegin();
+         it != mAdapterLoads.constEnd(); ++it) {
+        if (it->mLinks < 2 || it->mThroughput < 0.8 * mAdapterCapacity)
+            continue;
+        Controller *busiest = nullptr;
+        for (Controller *controller : mStation.controllers()) {
+            if (controller->adapter() == it.key() && !mMoves.contains(controller->address())
+                && (!busiest || controller->throughput() > busiest->throughput())) {
+                busiest = controller;
+            }
+        }
+        if (!busiest)
+            continue;
+        BluezQt::DevicePtr target = pickDevice(busiest->address());
+        if (!target || !target->adapter() || target->adapter()->address() == it.key())
+            continue;
+        const AdapterLoad load = mAdapterLoads.value(target->adapter()->address());
+        if (load.mThroughput + busiest->throughput() >= it->mThroughput)
+            continue;
+        qDebug() << "adapter" << it.key() << "is saturated, moving" << busiest->address()
+                 << "to" << target->adapter()->address();
+        mMoves.insert(busiest->address(), target->adapter()->address());
+        disconnect(linkedDevice(busiest->address()));
+    }
+}
+
 void InterConnect::autoConnect(BluezQt::DevicePtr device)
 {
     qDebug() << device->address() << device->name();
     qDebug() << device->uuids();
     if (device->uuids().contains(mSppUuid) || device->name() == "ESP train") {
+        const QString address = device->address();
+        if (mStation.controller(address) || mConnecting.contains(address))
+            return;
+        BluezQt::DevicePtr target = pickDevice(address);
+        if (target)
+            device = target;
+        mConnecting.insert(address);
         BluezQt::PendingCall *call = device->connectProfile(mSppUuid);
         connect(call, &BluezQt::PendingCall::finished,
-                [device] (BluezQt::PendingCall *call) {
+                this, [this, device, address] (BluezQt::PendingCall *call) {
+                    mConnecting.remove(address);
                     if (call->error() != BluezQt::PendingCall::NoError) {
                         qWarning() << device->name() << "auto connect error:" << call->errorText();
                     }
@@ -127,146 +296,123 @@ void InterConnect::autoConnect(BluezQt::DevicePtr device)
 
 void InterConnect::disconnect(BluezQt::DevicePtr device)
 {
-    if (mDevicesByAddress.contains(device->address())) {
-        qDebug() << "request disconnection" << device->address() << device->name();
-        BluezQt::PendingCall *call = device->disconnectProfile(mSppUuid);
-        connect(call, &BluezQt::PendingCall::finished,
-                [device] (BluezQt::PendingCall *call) {
-                    if (call->error() != BluezQt::PendingCall::NoError) {
-                        qWarning() << device->name() << "disconnection error:" << call->errorText();
-                    }
-                    //call->deleteLater();
-                    qDebug() << "disconnected from" << device->name();
-                });
-    }
+    if (!device)
+        return;
+
+    // Ignore the same controller seen through another adapter.
+    Controller *controller = mStation.controller(device->address());
+    if (!controller)
+        return;
+    if (device->adapter() && device->adapter()->address() != controller->adapter())
+        return;
+
+    qDebug() << "request disconnection" << device->address() << device->name();
+    BluezQt::PendingCall *call = device->disconnectProfile(mSppUuid);
+    connect(call, &BluezQt::PendingCall::finished,
+            [device] (BluezQt::PendingCall *call) {
+                if (call->error() != BluezQt::PendingCall::NoError) {
+                    qWarning() << device->name() << "disconnection error:" << call->errorText();
+                }
+                //call->deleteLater();
+                qDebug() << "disconnected from" << device->name();
+            });
 }
 
-void InterConnect::checkPing()
+void InterConnect::emergencyStop(const QString &device)
 {
-    qDebug() << "checking ping at" << QDateTime::currentDateTime();
-    for (const QString &device : mDevicesByAddress) {
-        qDebug() << "testing device" << device << "from" << mAliveDevices;
-        QSet<QString>::Iterator it = mAliveDevices.find(device);
-        if (it == mAliveDevices.end()) {
-            disconnect(deviceForAddress(device));
-        } else {
-            mAliveDevices.erase(it);
-        }
-    }
-    QSet<QString>::Iterator it = mDeadDevices.begin();
-    while (it != mDeadDevices.end()) {
-        qDebug() << "trying to reconnect device" << *it;
-        BluezQt::DevicePtr device = deviceForAddress(*it);
-        if (device) autoConnect(device);
-        it = mDeadDevices.erase(it);
-    }
+    mStation.emergencyStop(device);
 }
 
-void InterConnect::readFrame(const QString &device, const Frame &frame)
+bool InterConnect::requestSpeed(Track *track, float speed)
 {
-    Spp *spp = qobject_cast<Spp*>(sender());
-    if (!spp)
-        return;
+    return mStation.requestSpeed(track, speed);
+}
 
-    switch (frame.type()) {
-    case Frame::PING: {
-        qDebug() << "received a ping frame, preparing response" << device;
-        spp->send(device, frame.pingResponse());
-        mAliveDevices.insert(device);
-        return;
-    }
-    case Frame::CAPABILITIES: {
-        for (const Track::Definition &definition : frame.trackDefinitions()) {
-            Track *track = new Track(definition, this);
-            const QString key = device
-                + QString::fromLatin1("::") + QString::number(track->id());
-            if (mTracks.contains(key)) {
-                qWarning() << "unable to redefine track" << key;
-                delete track;
-            } else {
-                qDebug() << "inserting a new track" << key << track->label();
-                mTracks.insert(key, track);
-                connect(track, &Track::acquireRequest,
-                        [spp, device, track] () {
-                            spp->send(device, Frame::acquireFrame(track->id()));
-                        });
-                connect(track, &Track::releaseRequest,
-                        [spp, device, track] () {
-                            spp->send(device, Frame::releaseFrame(track->id()));
-                        });
-                connect(track, &Track::speedRequest,
-                        [spp, device, track] (int speed) {
-                            spp->send(device, Frame::speedFrame(track->id(), speed));
-                        });
-            }
-        }
-        emit tracksChanged();
-        return;
-    }
-    case Frame::TRACK_STATE: {
-        int id;
-        const Track::State state = frame.trackState(&id);
-        Track *tr = track(device, id);
-        if (!tr) {
-            qWarning() << "unknown track" << device << id;
-        } else {
-            qDebug() << "updating state" << device << id;
-            tr->setState(state);
-        }
-        return;
-    }
-    case Frame::ACQUIRE_ACK: {
-        int id;
-        bool ack = frame.ack(&id);
-        Track *tr = track(device, id);
-        if (!tr) {
-            qWarning() << "unknown track" << device << id;
-        } else {
-            qDebug() << "acquire ack" << device << id << ack;
-            if (ack)
-                tr->setLinked(true);
-        }
-        return;
-    }
-    case Frame::RELEASE_ACK: {
-        int id;
-        bool ack = frame.ack(&id);
-        Track *tr = track(device, id);
-        if (!tr) {
-            qWarning() << "unknown track" << device << id;
-        } else {
-            qDebug() << "release ack" << device << id << ack;
-            if (ack)
-                tr->setLinked(false);
-        }
-        return;
-    }
-    default:
-        return;
+void InterConnect::groupSpeed(const QVariantList &tracks, float speed)
+{
+    QList<Track*> group;
+    for (const QVariant &value : tracks) {
+        group.append(qobject_cast<Track*>(value.value<QObject*>()));
     }
+    mStation.groupSpeed(group, speed);
 }
 
 QStringList InterConnect::devices() const
 {
-    return mDevices;
+    return mStation.devices();
 }
 
 QVariantList InterConnect::tracks() const
 {
-    QVariantList list;
-    for (Track *track : mTracks) {
-        list.append(QVariant::fromValue(track));
-    }
-    return list;
+    return mStation.tracks();
+}
+
+Timetable* InterConnect::timetable()
+{
+    return mStation.timetable();
+}
+
+int InterConnect::stopLatency() const
+{
+    return mStation.stopLatency();
+}
+
+bool InterConnect::idle() const
+{
+    return mStation.idle();
+}
+
+float InterConnect::wakeups() const
+{
+    return mStation.wakeups();
+}
+
+bool InterConnect::hub() const
+{
+    return mStation.hub()->isListening();
 }
 
-Track* InterConnect::track(const QString &device, int id) const
+void InterConnect::setHub(bool hub)
 {
-    const QString key = device
-        + QString::fromLatin1("::") + QString::number(id);
-    if (!mTracks.contains(key)) {
-        return nullptr;
+    Hub *server = mStation.hub();
+    if (hub == server->isListening())
+        return;
+
+    if (hub) {
+        if (!server->listen(HUB_NAME))
+            return;
     } else {
-        return mTracks[key];
+        server->close();
     }
+    emit hubChanged();
+}
+
+int InterConnect::hubClients() const
+{
+    return mStation.hub()->clients();
+}
+
+int InterConnect::dispatchSkew() const
+{
+    return mStation.group()->dispatchSkew();
+}
+
+int InterConnect::groupSkew() const
+{
+    return mStation.group()->skew();
+}
+
+int InterConnect::adapterCapacity() const
+{
+    return mAdapterCapacity;
+}
+
+void InterConnect::setAdapterCapacity(int capacity)
+{
+    capacity = qMax(1, capacity);
+    if (capacity == mAdapterCapacity)
+        return;
+
+    mAdapterCapacity = capacity;
+    emit adapterCapacityChanged();
 }
@@ -9,18 +9,28 @@
 
 #include <BluezQt/Manager>
 #include <QQmlEngine>
-#include <QTimer>
 #include <QSet>
 
-#include "frame.h"
+#include "station.h"
 
 class Track;
+class Spp;
+class Controller;
 
 class InterConnect: public BluezQt::Manager
 {
     Q_OBJECT
     Q_PROPERTY(QStringList devices READ devices NOTIFY devicesChanged)
     Q_PROPERTY(QVariantList tracks READ tracks NOTIFY tracksChanged)
+    Q_PROPERTY(Timetable* timetable READ timetable CONSTANT)
+    Q_PROPERTY(int stopLatency READ stopLatency NOTIFY stopLatencyChanged)
+    Q_PROPERTY(bool idle READ idle NOTIFY idleChanged)
+    Q_PROPERTY(float wakeups READ wakeups NOTIFY wakeupsChanged)
+    Q_PROPERTY(bool hub READ hub WRITE setHub NOTIFY hubChanged)
+    Q_PROPERTY(int hubClients READ hubClients NOTIFY hubClientsChanged)
+    Q_PROPERTY(int dispatchSkew READ dispatchSkew NOTIFY groupSkewChanged)
+    Q_PROPERTY(int groupSkew READ groupSkew NOTIFY groupSkewChanged)
+    Q_PROPERTY(int adapterCapacity READ adapterCapacity WRITE setAdapterCapacity NOTIFY adapterCapacityChanged)
 
  public:
     ~InterConnect();
@@ -29,27 +39,80 @@ class InterConnect: public BluezQt::Manager
 
     QStringList devices() const;
     QVariantList tracks() const;
+    Timetable* timetable();
+    int stopLatency() const;
+    bool idle() const;
+    float wakeups() const;
+    bool hub() const;
+    void setHub(bool hub);
+    int hubClients() const;
+    int dispatchSkew() const;
+    int groupSkew() const;
+    int adapterCapacity() const;
+    void setAdapterCapacity(int capacity);
+
+    // Default throughput, in bytes per second, an adapter is assumed
+    // to sustain over all its serial links before devices are moved
+    // to another one, see pickDevice() and balance(). It is a
+    // conservative figure, well below the nominal RFCOMM throughput,
+    // leaving room for retransmissions with many links on a crowded
+    // band. Tune it with adapterCapacity for the hardware at hand.
+    static const int ADAPTER_CAPACITY = 16384;
+
+    // Local socket name the hub listens on, see Hub.
+    static const QString HUB_NAME;
+
+    Q_INVOKABLE void emergencyStop(const QString &device = QString());
+
+    // Speed request from the UI, refused while a hub client owns the
+    // track, see Hub.
+    Q_INVOKABLE bool requestSpeed(Track *track, float speed);
+
+    // Change the speed of several tracks at the same instant, see
+    // GroupCommand. An emergency stop cancels what is not applied yet.
+    Q_INVOKABLE void groupSpeed(const QVariantList &tracks, float speed);
 
  signals:
     void devicesChanged();
     void tracksChanged();
+    void stopLatencyChanged();
+    void idleChanged();
+    void wakeupsChanged();
+    void hubChanged();
+    void hubClientsChanged();
+    void groupSkewChanged();
+    void adapterCapacityChanged();
 
  private:
     InterConnect(QObject *parent = nullptr);
     void initialized(BluezQt::InitManagerJob *job);
     void scan(BluezQt::AdapterPtr adapter);
+    void forgetAdapter(BluezQt::AdapterPtr adapter);
+    BluezQt::DevicePtr pickDevice(const QString &address) const;
+    BluezQt::DevicePtr linkedDevice(const QString &address) const;
+    void balance();
     void autoConnect(BluezQt::DevicePtr device);
     void disconnect(BluezQt::DevicePtr device);
-    void readFrame(const QString &device, const Frame &frame);
-    void checkPing();
-    Track* track(const QString &device, int id) const;
+    void addController(Controller *controller);
+    void removeController(Controller *controller);
+    void updateDiscovery();
 
+    Spp *mSpp = nullptr;
     QString mSppUuid;
-    QStringList mDevices;
-    QHash<QString, Track*> mTracks;
-    QTimer mPingTimer;
-    QStringList mDevicesByAddress;
-    QSet<QString> mAliveDevices, mDeadDevices;
+    Station mStation;
+
+    // Devices are spread over all powered adapters, see pickDevice()
+    // and balance(), the latter on every keepalive check of the
+    // station. Throughputs are in bytes per second.
+    int mAdapterCapacity = ADAPTER_CAPACITY;
+    struct AdapterLoad
+    {
+        int mLinks = 0;
+        float mThroughput = 0.;
+    };
+    QHash<QString, AdapterLoad> mAdapterLoads;
+    QHash<QString, QString> mMoves;
+    QSet<QString> mConnecting;
 };
 
 #endif
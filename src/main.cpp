@@ -10,6 +10,9 @@
 
 #include "interconnect.h"
 #include "track.h"
+#include "timetable.h"
+#include "historymodel.h"
+#include "trackoverview.h"
 
 int main(int argc, char *argv[])
 {
@@ -19,6 +22,10 @@ int main(int argc, char *argv[])
 
     qmlRegisterUncreatableType<Track>("Train.Station", 1, 0, "Track",
                                       "Track can be obtained from InterConnect.");
+    qmlRegisterUncreatableType<Timetable>("Train.Station", 1, 0, "Timetable",
+                                          "Timetable can be obtained from InterConnect.");
+    qmlRegisterType<HistoryModel>("Train.Station", 1, 0, "HistoryModel");
+    qmlRegisterType<TrackOverview>("Train.Station", 1, 0, "TrackOverview");
     qmlRegisterSingletonType<InterConnect>("Train.Station", 1, 0, "InterConnect",
                                            InterConnect::instance);
 
@@ -0,0 +1,70 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "codec.h"
+#include "frame.h"
+
+// The fixed size frames of the wire protocol. CAPABILITIES carries a
+// variable number of track definitions and is read by hand in Frame.
+namespace Protocol {
+
+// count
+typedef Codec::Message<Frame::PING, quint64> Ping;
+// id, is forward, is backward, speed, count, position
+typedef Codec::Message<Frame::TRACK_STATE,
+                       quint32, qint32, qint32, qint32, quint32, qint32> TrackState;
+// the same, followed by the device time in µs, with TIMESTAMPS
+typedef Codec::Message<Frame::TRACK_STATE,
+                       quint32, qint32, qint32, qint32, quint32, qint32,
+                       quint64> StampedTrackState;
+// id
+typedef Codec::Message<Frame::ACQUIRE_TRACK, quint32> AcquireTrack;
+// id, ack
+typedef Codec::Message<Frame::ACQUIRE_ACK, quint32, quint32> AcquireAck;
+// id
+typedef Codec::Message<Frame::RELEASE_TRACK, quint32> ReleaseTrack;
+// id, ack
+typedef Codec::Message<Frame::RELEASE_ACK, quint32, quint32> ReleaseAck;
+// id, speed
+typedef Codec::Message<Frame::SPEED_COMMAND, quint32, qint32> SpeedCommand;
+// enabled features
+typedef Codec::Message<Frame::PROTOCOL, quint32> Features;
+typedef Codec::Message<Frame::STATE_REQUEST> StateRequest;
+// first missed sequence
+typedef Codec::Message<Frame::NACK, quint32> Nack;
+// id, interval in milliseconds
+typedef Codec::Message<Frame::REPORT_INTERVAL, quint32, quint32> ReportInterval;
+// host send time in µs
+typedef Codec::Message<Frame::TIME_REQUEST, quint64> TimeRequest;
+// echoed host send time, device receive and send times, in µs
+typedef Codec::Message<Frame::TIME_REPLY, quint64, quint64, quint64> TimeReply;
+// id, speed, device time in µs at which to apply it. The device
+// queues it until then; any SPEED_COMMAND for the track, an emergency
+// stop included, discards the queued ones.
+typedef Codec::Message<Frame::SCHEDULED_SPEED, quint32, qint32, quint64> ScheduledSpeed;
+
+static_assert(Ping::SIZE == 12, "PING frame size");
+static_assert(TrackState::SIZE == 28, "TRACK_STATE frame size");
+static_assert(AcquireTrack::SIZE == 8, "ACQUIRE_TRACK frame size");
+static_assert(AcquireAck::SIZE == 12, "ACQUIRE_ACK frame size");
+static_assert(ReleaseTrack::SIZE == 8, "RELEASE_TRACK frame size");
+static_assert(ReleaseAck::SIZE == 12, "RELEASE_ACK frame size");
+static_assert(SpeedCommand::SIZE == 12, "SPEED_COMMAND frame size");
+static_assert(Features::SIZE == 8, "PROTOCOL frame size");
+static_assert(StateRequest::SIZE == 4, "STATE_REQUEST frame size");
+static_assert(Nack::SIZE == 8, "NACK frame size");
+static_assert(ReportInterval::SIZE == 12, "REPORT_INTERVAL frame size");
+static_assert(StampedTrackState::SIZE == 36, "stamped TRACK_STATE frame size");
+static_assert(TimeRequest::SIZE == 12, "TIME_REQUEST frame size");
+static_assert(TimeReply::SIZE == 28, "TIME_REPLY frame size");
+static_assert(ScheduledSpeed::SIZE == 20, "SCHEDULED_SPEED frame size");
+
+}
+
+#endif
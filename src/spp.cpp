@@ -8,6 +8,7 @@
 
 #include <QDBusObjectPath>
 #include <BluezQt/Device>
+#include <BluezQt/Adapter>
 
 Spp::Spp(const QString &uuid, QObject *parent)
     : BluezQt::Profile(parent)
@@ -40,7 +41,7 @@ void Spp::newConnection(BluezQt::DevicePtr device,
                         const QVariantMap &properties,
                         const BluezQt::Request<> &request)
 {
-    if (mSockets.contains(device->address())) {
+    if (mControllers.contains(device->address())) {
         qWarning() << "device already connected" << device->address();
         request.cancel();
         return;
@@ -51,11 +52,14 @@ void Spp::newConnection(BluezQt::DevicePtr device,
         return;
     }
     qDebug() << "new connection to" << device->address() << device->name();
-    socket->setProperty("device", device->address());
-    connect(socket.data(), &QIODevice::readyRead,
-            this, &Spp::dataAvailable);
-    mSockets.insert(device->address(), socket);
-    emit connected(device->address(), device->name());
+    Controller *controller = new Controller(device->address(), device->name(),
+                                            device->adapter() ? device->adapter()->address() : QString(),
+                                            socket, this);
+    mControllers.insert(device->address(), controller);
+    const QString address = device->address();
+    connect(controller, &Controller::linkLost,
+            this, [this, address] () {drop(address);});
+    emit connected(controller);
     request.accept();
 }
 
@@ -68,37 +72,21 @@ void Spp::requestDisconnection(BluezQt::DevicePtr device,
                                const BluezQt::Request<> &request)
 {
     qDebug() << "disconnecting profile" << device->address() << device->name();
-    mSockets.remove(device->address());
-    emit disconnected(device->address(), device->name());
+    drop(device->address());
     request.accept();
 }
 
-void Spp::dataAvailable()
+void Spp::drop(const QString &address)
 {
-    QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
-    emit frameAvailable(socket->property("device").toString(),
-                        Frame(socket->readAll()));
+    Controller *controller = mControllers.take(address);
+    if (controller) {
+        QObject::disconnect(controller, nullptr, this, nullptr);
+        emit disconnected(controller);
+        controller->deleteLater();
+    }
 }
 
-void Spp::send(const QString &device, const QByteArray &data) const
+Controller* Spp::controller(const QString &device) const
 {
-    QHash<QString, QSharedPointer<QLocalSocket>>::ConstIterator it = mSockets.find(device);
-    if (it == mSockets.constEnd()) {
-        qWarning() << "Unknown device" << device;
-        return;
-    }
-
-    qDebug() << "sending data to" << device << data;
-    const char *pt = data.constData();
-    qint64 len = data.length();
-    do {
-        qint64 part = (*it)->write(pt, len);
-        if (part < 0) {
-            qWarning() << "Error sending" << data;
-            return;
-        }
-        pt += part;
-        len -= part;
-    } while (len > 0);
-    qDebug() << "data sent to" << device;
+    return mControllers.value(device, nullptr);
 }
@@ -11,7 +11,7 @@
 #include <QSharedPointer>
 #include <QLocalSocket>
 
-#include "frame.h"
+#include "controller.h"
 
 class Spp: public BluezQt::Profile
 {
@@ -31,18 +31,18 @@ class Spp: public BluezQt::Profile
                               const BluezQt::Request<> &request) override;
     void release() override;
 
-    void send(const QString &device, const QByteArray &data) const;
+    Controller* controller(const QString &device) const;
+    // Close the link to device from this side, like a disconnection
+    // request from BlueZ.
+    void drop(const QString &address);
 
  signals:
-    void connected(const QString &device, const QString &name);
-    void disconnected(const QString &device, const QString &name);
-    void frameAvailable(const QString &device, const Frame &frame);
+    void connected(Controller *controller);
+    void disconnected(Controller *controller);
 
  private:
-    void dataAvailable();
-    
     QString mUuid;
-    QHash<QString, QSharedPointer<QLocalSocket>> mSockets;
+    QHash<QString, Controller*> mControllers;
 };
 
 #endif
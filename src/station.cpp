@@ -0,0 +1,282 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "station.h"
+
+#include <QDebug>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QAbstractEventDispatcher>
+#include <algorithm>
+
+#include "controller.h"
+#include "track.h"
+
+Station::Station(QObject *parent)
+    : QObject(parent)
+{
+    mPingTimer.setInterval(PING_INTERVAL);
+    connect(&mPingTimer, &QTimer::timeout, this, &Station::checkPing);
+    connect(&mTimetable, &Timetable::pendingChanged,
+            this, &Station::updateIdle);
+    connect(&mTimetable, &Timetable::managedChanged,
+            this, &Station::updateReportRate);
+    connect(&mHub, &Hub::clientsChanged,
+            this, [this] () {
+                for (Controller *controller : mControllers) {
+                    for (Track *track : controller->tracks()) {
+                        updateReportRate(track);
+                    }
+                }
+            });
+    // Count the main loop wake-ups, reported as a rate in checkPing().
+    QAbstractEventDispatcher *dispatcher = QAbstractEventDispatcher::instance();
+    if (dispatcher)
+        connect(dispatcher, &QAbstractEventDispatcher::awake,
+                this, [this] () {mAwake += 1;});
+}
+
+Station::~Station()
+{
+}
+
+void Station::addController(Controller *controller)
+{
+    mControllers.insert(controller->address(), controller);
+    mSortedControllers.insert(std::lower_bound(mSortedControllers.begin(), mSortedControllers.end(),
+                                               controller, [] (Controller *a, Controller *b) {
+                                                   return a->address() < b->address();
+                                               }), controller);
+    connect(controller, &Controller::trackAdded,
+            this, &Station::addTrack);
+    connect(controller, &Controller::tracksChanged,
+            this, &Station::tracksChanged);
+    emit devicesChanged();
+    mPingTimer.start();
+    updateIdle();
+}
+
+void Station::removeController(Controller *controller)
+{
+    if (!mControllers.remove(controller->address()))
+        return;
+    mSortedControllers.removeOne(controller);
+
+    QObject::disconnect(controller, nullptr, this, nullptr);
+    for (Track *track : controller->tracks()) {
+        mTimetable.removeTrack(track);
+        mClock.unsubscribe(track);
+        mHub.removeTrack(track);
+        mGroup.removeTrack(track);
+    }
+    mDeadDevices.insert(controller->address());
+    emit devicesChanged();
+    emit tracksChanged();
+    updateIdle();
+}
+
+Controller* Station::controller(const QString &address) const
+{
+    return mControllers.value(address, nullptr);
+}
+
+QList<Controller*> Station::controllers() const
+{
+    return mSortedControllers;
+}
+
+void Station::addTrack(Track *track)
+{
+    mTimetable.addTrack(track);
+    track->setClock(&mClock);
+    track->setPrediction(true);
+    mHub.addTrack(track);
+    mGroup.addTrack(track);
+    connect(track, &Track::directionChanged,
+            this, &Station::updateIdle);
+    connect(track, &Track::speedChanged,
+            this, &Station::updateIdle);
+    connect(track, &Track::speedRequest,
+            this, &Station::updateIdle);
+    connect(track, &Track::focusedChanged,
+            this, [this, track] () {updateReportRate(track);});
+    connect(track, &Track::watchedChanged,
+            this, [this, track] () {updateReportRate(track);});
+    connect(track, &Track::linkedChanged,
+            this, [this, track] () {updateReportRate(track);});
+    updateIdle();
+    updateReportRate(track);
+}
+
+void Station::updateReportRate(Track *track)
+{
+    // Hub clients display every track, the timetable reacts to the
+    // positions of the tracks it drives.
+    const bool watched = track->watched() || mHub.clients() > 0
+        || mTimetable.manages(track);
+    if (track->focused()) {
+        track->setReportInterval(FOCUSED_REPORT_INTERVAL);
+    } else if (track->linked() && watched) {
+        track->setReportInterval(WATCHED_REPORT_INTERVAL);
+    } else {
+        track->setReportInterval(BACKGROUND_REPORT_INTERVAL);
+    }
+}
+
+void Station::updateIdle()
+{
+    bool idle = !mControllers.isEmpty() && !mTimetable.pending();
+    for (Controller *controller : mControllers) {
+        for (Track *track : controller->tracks()) {
+            idle = idle && track->direction() == Track::IDLE
+                && track->speed() == 0. && track->requestedSpeed() == 0.;
+        }
+    }
+    if (idle == mIdle)
+        return;
+
+    // Nothing moves: slow down the keepalive.
+    mIdle = idle;
+    qDebug() << (mIdle ? "entering" : "leaving") << "idle mode";
+    mPingTimer.setInterval(mIdle ? IDLE_PING_INTERVAL : PING_INTERVAL);
+    emit idleChanged();
+}
+
+void Station::checkPing()
+{
+    qDebug() << "checking ping at" << QDateTime::currentDateTime();
+    mWakeups = mAwake * 1000. / mPingTimer.interval();
+    mAwake = 0;
+    qDebug() << "main loop wake-ups:" << mWakeups << "per second";
+    emit wakeupsChanged();
+    // Iterate on a copy, closing a link may remove its controller.
+    const QList<Controller*> controllers = mSortedControllers;
+    for (Controller *controller : controllers) {
+        if (!controller->checkAlive()) {
+            qDebug() << "no ping from device" << controller->address();
+            emit unresponsive(controller);
+        }
+    }
+    for (Controller *controller : mSortedControllers) {
+        const float throughput = controller->sampleThroughput(mPingTimer.interval());
+        qDebug() << "device" << controller->address() << throughput << "B/s,"
+                 << controller->backlog() << "bytes pending,"
+                 << controller->stalls() << "write stalls for"
+                 << controller->stallTime() << "us,"
+                 << controller->reportLatency() << "us report latency";
+    }
+    emit checked();
+    if (mHub.isListening()) {
+        qDebug() << "hub fan-out" << mHub.sampleFanout(mPingTimer.interval())
+                 << "B/s to" << mHub.clients() << "clients";
+    }
+    QSet<QString>::Iterator it = mDeadDevices.begin();
+    while (it != mDeadDevices.end()) {
+        const QString address = *it;
+        it = mDeadDevices.erase(it);
+        qDebug() << "trying to reconnect device" << address;
+        emit reconnect(address);
+    }
+}
+
+QStringList Station::devices() const
+{
+    QStringList list;
+    for (Controller *controller : mSortedControllers) {
+        list.append(controller->name());
+    }
+    return list;
+}
+
+QVariantList Station::tracks() const
+{
+    QVariantList list;
+    for (Controller *controller : mSortedControllers) {
+        for (Track *track : controller->tracks()) {
+            list.append(QVariant::fromValue(track));
+        }
+    }
+    return list;
+}
+
+Timetable* Station::timetable()
+{
+    return &mTimetable;
+}
+
+Hub* Station::hub()
+{
+    return &mHub;
+}
+
+const Hub* Station::hub() const
+{
+    return &mHub;
+}
+
+GroupCommand* Station::group()
+{
+    return &mGroup;
+}
+
+const GroupCommand* Station::group() const
+{
+    return &mGroup;
+}
+
+void Station::emergencyStop(const QString &device)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    for (Controller *controller : mControllers) {
+        if (!device.isEmpty() && controller->address() != device)
+            continue;
+        for (Track *track : controller->tracks()) {
+            mTimetable.cancel(track);
+            mGroup.cancel(track);
+        }
+        controller->emergencyStop();
+    }
+
+    mStopLatency = int(elapsed.nsecsElapsed() / 1000);
+    if (mStopLatency > STOP_LATENCY_BOUND) {
+        qWarning() << "emergency stop latency out of bound" << mStopLatency << "us";
+    }
+    qWarning() << "emergency stop" << (device.isEmpty() ? QString::fromLatin1("all") : device)
+               << "written in" << mStopLatency << "us";
+    emit stopLatencyChanged();
+}
+
+int Station::stopLatency() const
+{
+    return mStopLatency;
+}
+
+bool Station::requestSpeed(Track *track, float speed)
+{
+    return track && mHub.requestSpeed(track, speed);
+}
+
+void Station::groupSpeed(const QList<Track*> &tracks, float speed)
+{
+    mGroup.send(tracks, speed);
+}
+
+bool Station::idle() const
+{
+    return mIdle;
+}
+
+float Station::wakeups() const
+{
+    return mWakeups;
+}
+
+int Station::pingInterval() const
+{
+    return mPingTimer.interval();
+}
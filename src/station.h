@@ -0,0 +1,121 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef STATION_H
+#define STATION_H
+
+#include <QObject>
+#include <QTimer>
+#include <QSet>
+#include <QHash>
+#include <QList>
+
+#include "timetable.h"
+#include "controlclock.h"
+#include "hub.h"
+#include "groupcommand.h"
+
+class Track;
+class Controller;
+
+// The connected controllers and their tracks, wired to the timetable,
+// the control clock, the hub and the group commands, with the
+// keepalive and idle logic. It knows nothing of Bluetooth: InterConnect
+// feeds it the controllers of its serial links and reacts to the
+// signals asking to close or reopen them, the stress harness does the
+// same with emulated devices.
+class Station: public QObject
+{
+    Q_OBJECT
+ public:
+    Station(QObject *parent = nullptr);
+    ~Station();
+
+    // Bound, in microseconds, on the time to write an emergency stop
+    // to every connected device. It only covers the local writes:
+    // bytes already buffered by a socket still go out first.
+    static const int STOP_LATENCY_BOUND = 5000;
+
+    // Keepalive periods, in milliseconds, while trains run and while
+    // every track is stopped with nothing scheduled.
+    static const int PING_INTERVAL = 3000;
+    static const int IDLE_PING_INTERVAL = 10000;
+
+    // State report intervals, in milliseconds, of the track under
+    // the slider, of the other displayed and linked tracks, and of
+    // the remaining ones. The track speed prediction keeps the
+    // display smooth between two reports.
+    static const int FOCUSED_REPORT_INTERVAL = 250;
+    static const int WATCHED_REPORT_INTERVAL = 500;
+    static const int BACKGROUND_REPORT_INTERVAL = 2000;
+
+    void addController(Controller *controller);
+    // A device that was connected is reported by reconnect() on the
+    // next keepalive check.
+    void removeController(Controller *controller);
+    Controller* controller(const QString &address) const;
+    QList<Controller*> controllers() const;
+
+    // Sorted by device address.
+    QStringList devices() const;
+    QVariantList tracks() const;
+
+    Timetable* timetable();
+    Hub* hub();
+    const Hub* hub() const;
+    GroupCommand* group();
+    const GroupCommand* group() const;
+
+    void emergencyStop(const QString &device = QString());
+    int stopLatency() const;
+    // Speed request from the UI, refused while a hub client owns the
+    // track, see Hub.
+    bool requestSpeed(Track *track, float speed);
+    void groupSpeed(const QList<Track*> &tracks, float speed);
+
+    bool idle() const;
+    float wakeups() const;
+    // Interval between two keepalive checks, in milliseconds.
+    int pingInterval() const;
+
+ signals:
+    void devicesChanged();
+    void tracksChanged();
+    void stopLatencyChanged();
+    void idleChanged();
+    void wakeupsChanged();
+    // No ping from the device since the last check, its link should
+    // be closed.
+    void unresponsive(Controller *controller);
+    // Emitted on every keepalive check, after the throughputs of the
+    // links have been sampled.
+    void checked();
+    // A device lost since the last check, to be reconnected.
+    void reconnect(const QString &address);
+
+ private:
+    void addTrack(Track *track);
+    void checkPing();
+    void updateIdle();
+    void updateReportRate(Track *track);
+
+    QHash<QString, Controller*> mControllers;
+    // The same, sorted by address, for a stable order of devices and
+    // tracks.
+    QList<Controller*> mSortedControllers;
+    QTimer mPingTimer;
+    Timetable mTimetable;
+    ControlClock mClock;
+    Hub mHub;
+    GroupCommand mGroup;
+    int mStopLatency = 0;
+    QSet<QString> mDeadDevices;
+    bool mIdle = false;
+    int mAwake = 0;
+    float mWakeups = 0.;
+};
+
+#endif
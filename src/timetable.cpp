@@ -0,0 +1,236 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "timetable.h"
+
+#include <QDebug>
+
+#include "track.h"
+
+Timetable::Timetable(QObject *parent)
+    : QObject(parent)
+{
+    mClock.start();
+    mTimer.setSingleShot(true);
+    mTimer.setTimerType(Qt::PreciseTimer);
+    connect(&mTimer, &QTimer::timeout, this, &Timetable::expire);
+}
+
+Timetable::~Timetable()
+{
+}
+
+void Timetable::addTrack(Track *track)
+{
+    connect(track, &Track::positionChanged,
+            this, [this, track] () {positionChanged(track);});
+    connect(track, &Track::speedRequest,
+            this, [this, track] () {commandSent(track);});
+    connect(track, &QObject::destroyed,
+            this, [this, track] () {removeTrack(track);});
+}
+
+void Timetable::removeTrack(Track *track)
+{
+    QObject::disconnect(track, nullptr, this, nullptr);
+    mStops.remove(track);
+    mPending.remove(track);
+    unschedule(track);
+}
+
+void Timetable::cancel(Track *track)
+{
+    mPending.remove(track);
+    unschedule(track);
+    // The speed before the stop is not to be resumed either.
+    QHash<Track*, Stop>::Iterator stop = mStops.find(track);
+    if (stop != mStops.end()) {
+        stop->mSuspended = true;
+        stop->mResumeSpeed = 0.;
+    }
+    emit managedChanged(track);
+}
+
+void Timetable::setStop(Track *track, int dwell, float departureSpeed)
+{
+    if (!track)
+        return;
+
+    Stop &stop = mStops[track];
+    stop.mDwell = qMax(0, dwell);
+    stop.mDepartureSpeed = departureSpeed;
+    stop.mSuspended = false;
+    emit managedChanged(track);
+}
+
+void Timetable::clearStop(Track *track)
+{
+    mStops.remove(track);
+    unschedule(track);
+    emit managedChanged(track);
+}
+
+void Timetable::resume(Track *track)
+{
+    QHash<Track*, Stop>::Iterator stop = mStops.find(track);
+    if (stop != mStops.end())
+        stop->mSuspended = false;
+    emit managedChanged(track);
+}
+
+bool Timetable::suspended(Track *track) const
+{
+    return mStops.value(track).mSuspended;
+}
+
+bool Timetable::manages(Track *track) const
+{
+    QHash<Track*, Stop>::ConstIterator stop = mStops.constFind(track);
+    if (stop != mStops.constEnd() && !stop->mSuspended)
+        return true;
+    for (const Departure &departure : mWheel) {
+        if (departure.mTrack == track)
+            return true;
+    }
+    return false;
+}
+
+void Timetable::scheduleDeparture(Track *track, int delay, float speed)
+{
+    if (!track)
+        return;
+
+    schedule(track, mClock.nsecsElapsed() + qint64(qMax(0, delay)) * 1000000, speed);
+}
+
+void Timetable::resetLatency()
+{
+    mLastLatency = 0;
+    mMaxLatency = 0;
+    emit latencyChanged();
+}
+
+int Timetable::lastLatency() const
+{
+    return mLastLatency;
+}
+
+int Timetable::maxLatency() const
+{
+    return mMaxLatency;
+}
+
+bool Timetable::pending() const
+{
+    return !mWheel.isEmpty();
+}
+
+void Timetable::positionChanged(Track *track)
+{
+    const qint64 now = mClock.nsecsElapsed();
+    QHash<Track*, Stop>::Iterator stop = mStops.find(track);
+    if (stop == mStops.end() || stop->mSuspended)
+        return;
+
+    switch (track->position()) {
+    case Track::STOPPING:
+        if (track->requestedSpeed() != 0.)
+            stop->mResumeSpeed = track->requestedSpeed();
+        command(track, 0., now);
+        return;
+    case Track::IN_STATION: {
+        const float speed = stop->mDepartureSpeed != 0.
+            ? stop->mDepartureSpeed : stop->mResumeSpeed;
+        if (speed != 0.)
+            schedule(track, now + qint64(stop->mDwell) * 1000000, speed);
+        return;
+    }
+    default:
+        return;
+    }
+}
+
+void Timetable::command(Track *track, float speed, qint64 since)
+{
+    if (!track->linked()) {
+        qWarning() << "timetable cannot command unlinked track" << track->label();
+        return;
+    }
+    if (track->requestedSpeed() == speed)
+        return;
+
+    mPending.insert(track, since);
+    track->requestSpeed(speed);
+}
+
+void Timetable::commandSent(Track *track)
+{
+    QHash<Track*, qint64>::Iterator it = mPending.find(track);
+    if (it == mPending.end())
+        return;
+
+    mLastLatency = int((mClock.nsecsElapsed() - *it) / 1000);
+    mMaxLatency = qMax(mMaxLatency, mLastLatency);
+    mPending.erase(it);
+    if (mLastLatency > LATENCY_BOUND) {
+        qWarning() << "timetable command latency out of bound" << track->label()
+                   << mLastLatency << "us";
+    }
+    emit latencyChanged();
+}
+
+void Timetable::schedule(Track *track, qint64 deadline, float speed)
+{
+    unschedule(track);
+    Departure departure;
+    departure.mTrack = track;
+    departure.mSpeed = speed;
+    mWheel.insert(deadline, departure);
+    arm();
+    emit managedChanged(track);
+}
+
+void Timetable::unschedule(Track *track)
+{
+    QMultiMap<qint64, Departure>::Iterator it = mWheel.begin();
+    while (it != mWheel.end()) {
+        if (it->mTrack == track) {
+            it = mWheel.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    arm();
+}
+
+void Timetable::expire()
+{
+    const qint64 now = mClock.nsecsElapsed();
+    while (!mWheel.isEmpty() && mWheel.firstKey() <= now) {
+        QMultiMap<qint64, Departure>::Iterator first = mWheel.begin();
+        const qint64 deadline = first.key();
+        const Departure departure = first.value();
+        mWheel.erase(first);
+        qDebug() << "timetable departure" << departure.mTrack->label() << departure.mSpeed;
+        command(departure.mTrack, departure.mSpeed, deadline);
+        emit managedChanged(departure.mTrack);
+    }
+    arm();
+}
+
+void Timetable::arm()
+{
+    if (mWheel.isEmpty()) {
+        mTimer.stop();
+    } else {
+        const qint64 delay = (mWheel.firstKey() - mClock.nsecsElapsed()) / 1000000;
+        mTimer.start(int(qMax(qint64(0), delay)));
+    }
+    if (mArmed != !mWheel.isEmpty()) {
+        mArmed = !mWheel.isEmpty();
+        emit pendingChanged();
+    }
+}
@@ -0,0 +1,91 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef TIMETABLE_H
+#define TIMETABLE_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QMultiMap>
+#include <QHash>
+
+#include "track.h"
+
+class Timetable: public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int lastLatency READ lastLatency NOTIFY latencyChanged)
+    Q_PROPERTY(int maxLatency READ maxLatency NOTIFY latencyChanged)
+    Q_PROPERTY(bool pending READ pending NOTIFY pendingChanged)
+
+ public:
+    // Upper bound, in microseconds, between a position event and the
+    // corresponding speed command. It covers the Track command throttle.
+    static const int LATENCY_BOUND = 150000;
+
+    Timetable(QObject *parent = nullptr);
+    ~Timetable();
+
+    void addTrack(Track *track);
+    void removeTrack(Track *track);
+    // Drop the pending departure of track and suspend its stop rule,
+    // after an emergency stop.
+    void cancel(Track *track);
+
+    // Setting a stop rule, or resuming it, re-arms it.
+    Q_INVOKABLE void setStop(Track *track, int dwell, float departureSpeed = 0.);
+    Q_INVOKABLE void clearStop(Track *track);
+    Q_INVOKABLE void resume(Track *track);
+    Q_INVOKABLE bool suspended(Track *track) const;
+    // Whether the timetable may command track on its own: an armed
+    // stop rule or a pending departure.
+    bool manages(Track *track) const;
+    Q_INVOKABLE void scheduleDeparture(Track *track, int delay, float speed);
+    Q_INVOKABLE void resetLatency();
+
+    int lastLatency() const;
+    int maxLatency() const;
+    bool pending() const;
+
+ signals:
+    void latencyChanged();
+    void pendingChanged();
+    void managedChanged(Track *track);
+
+ private:
+    struct Stop
+    {
+        int mDwell = 0;
+        float mDepartureSpeed = 0.;
+        float mResumeSpeed = 0.;
+        bool mSuspended = false;
+    };
+    struct Departure
+    {
+        Track *mTrack;
+        float mSpeed;
+    };
+
+    void positionChanged(Track *track);
+    void command(Track *track, float speed, qint64 since);
+    void commandSent(Track *track);
+    void schedule(Track *track, qint64 deadline, float speed);
+    void unschedule(Track *track);
+    void expire();
+    void arm();
+
+    QHash<Track*, Stop> mStops;
+    QHash<Track*, qint64> mPending;
+    QMultiMap<qint64, Departure> mWheel;
+    QElapsedTimer mClock;
+    QTimer mTimer;
+    bool mArmed = false;
+    int mLastLatency = 0;
+    int mMaxLatency = 0;
+};
+
+#endif
@@ -8,22 +8,22 @@
 
 #include <QDebug>
 #include <QtEndian>
+#include <cmath>
+
+#include "controlclock.h"
+#include "controller.h"
+#include "protocol.h"
 
 Track::Track(QObject *parent)
     : QObject(parent)
 {
-    mDelay.setInterval(100);
-    mDelay.setSingleShot(true);
-    connect(&mDelay, &QTimer::timeout, this, &Track::emitCommand);
 }
 
-Track::Track(const Definition &definition, QObject *parent)
-    : QObject(parent)
+Track::Track(const Definition &definition, Controller *controller)
+    : QObject(controller)
+    , mController(controller)
     , mDefinition(definition)
 {
-    mDelay.setInterval(100);
-    mDelay.setSingleShot(true);
-    connect(&mDelay, &QTimer::timeout, this, &Track::emitCommand);
 }
 
 Track::~Track()
@@ -40,6 +40,11 @@ QString Track::label() const
     return mDefinition.mLabel;
 }
 
+int Track::maxSpeed() const
+{
+    return mDefinition.mMaxSpeed;
+}
+
 Track::Capabilities Track::capabilities() const
 {
     return mDefinition.mCapabilities;
@@ -70,7 +75,138 @@ bool Track::linked() const
     return mLinked;
 }
 
-void Track::setState(const State &state)
+float Track::requestedSpeed() const
+{
+    return mSpeedRequest;
+}
+
+float Track::acceleration() const
+{
+    return mAcceleration;
+}
+
+void Track::setAcceleration(float acceleration)
+{
+    acceleration = qMax(0.f, acceleration);
+    if (acceleration == mAcceleration)
+        return;
+
+    mAcceleration = acceleration;
+    emit accelerationChanged();
+}
+
+float Track::deceleration() const
+{
+    return mDeceleration;
+}
+
+void Track::setDeceleration(float deceleration)
+{
+    deceleration = qMax(0.f, deceleration);
+    if (deceleration == mDeceleration)
+        return;
+
+    mDeceleration = deceleration;
+    emit decelerationChanged();
+}
+
+bool Track::focused() const
+{
+    return mFocused;
+}
+
+void Track::setFocused(bool focused)
+{
+    if (focused == mFocused)
+        return;
+
+    mFocused = focused;
+    emit focusedChanged();
+}
+
+bool Track::watched() const
+{
+    return mWatched;
+}
+
+void Track::setWatched(bool watched)
+{
+    if (watched == mWatched)
+        return;
+
+    mWatched = watched;
+    emit watchedChanged();
+}
+
+int Track::reportInterval() const
+{
+    return mReportInterval;
+}
+
+void Track::setReportInterval(int interval)
+{
+    if (interval == mReportInterval)
+        return;
+
+    mReportInterval = interval;
+    if (mController && mController->supports(Frame::REPORT_RATE)) {
+        qDebug() << "report interval:" << label() << mReportInterval << "ms";
+        Protocol::ReportInterval::Buffer buffer;
+        mController->send(buffer, Protocol::ReportInterval::encode(buffer, id(), mReportInterval));
+    }
+}
+
+qint64 Track::stateTime() const
+{
+    return mStateTime;
+}
+
+bool Track::prediction() const
+{
+    return mPrediction;
+}
+
+void Track::setPrediction(bool prediction)
+{
+    if (prediction == mPrediction)
+        return;
+
+    mPrediction = prediction;
+    mEstimateTime = History::now();
+    if (mPrediction && mClock)
+        mClock->subscribe(this);
+    emit predictionChanged();
+    emit estimateChanged();
+}
+
+float Track::estimatedSpeed() const
+{
+    return mPrediction ? qAbs(mEstimate) : speed();
+}
+
+float Track::odometer() const
+{
+    return mOdometer;
+}
+
+float Track::lapProgress() const
+{
+    if (mLapStart < 0. || mLapLength <= 0.)
+        return 0.;
+    return qMin(1.f, (mOdometer - mLapStart) / mLapLength);
+}
+
+void Track::setClock(ControlClock *clock)
+{
+    mClock = clock;
+}
+
+const History& Track::history() const
+{
+    return mHistory;
+}
+
+void Track::setState(const State &state, qint64 time)
 {
     State old = mState;
 
@@ -91,16 +227,45 @@ void Track::setState(const State &state)
         qDebug() << "position:" << mState.mPosition;
         emit positionChanged();
     }
+    const qint64 now = History::now();
+    const float reported = mState.mDirection == BACKWARD ? -speed() : speed();
+    const bool passage = old.mCount != mState.mCount && mHistory.size() > 0;
+    mStateTime = time < 0 ? History::nowUs() : time;
+    // Keep the history sorted whatever the clock corrections.
+    qint64 stamp = qMin(mStateTime / 1000, now);
+    if (mHistory.size() > 0)
+        stamp = qMax(stamp, mHistory.at(mHistory.size() - 1).mTime);
+    mHistory.append(stamp, reported, mState.mCount);
+    emit historyChanged();
+
+    // Correct the prediction, the distance travelled since the last
+    // estimate being accounted at the previous estimated speed.
+    advance(now);
+    mEstimate = reported;
+    if (passage) {
+        if (mLapStart >= 0.)
+            mLapLength = mOdometer - mLapStart;
+        mLapStart = mOdometer;
+    }
+    if (mPrediction && mClock && mEstimate != 0.)
+        mClock->subscribe(this);
+    emit estimateChanged();
 }
 
 void Track::acquire()
 {
-    emit acquireRequest();
+    if (mController) {
+        Protocol::AcquireTrack::Buffer buffer;
+        mController->send(buffer, Protocol::AcquireTrack::encode(buffer, id()));
+    }
 }
 
 void Track::release()
 {
-    emit releaseRequest();
+    if (mController) {
+        Protocol::ReleaseTrack::Buffer buffer;
+        mController->send(buffer, Protocol::ReleaseTrack::encode(buffer, id()));
+    }
 }
 
 void Track::setLinked(bool linked)
@@ -120,17 +285,146 @@ void Track::requestSpeed(float speed)
     if (speed == mSpeedRequest)
         return;
 
+    // A command is pending when the previous request is not sent yet,
+    // and mSent holds until the next tick once one has been sent. The
+    // clock subscription tells neither, it also runs the prediction.
+    const bool pending = mSent || mSpeedCommand != mSpeedRequest;
     mSpeedRequest = speed;
-    if (!mDelay.isActive()) {
-        emitCommand();
-        mDelay.start();
+    if (!mClock) {
+        sendSpeed(mSpeedRequest);
+        return;
+    }
+    // Without ramp, the first command is sent at once, the following
+    // ones are throttled to one per tick of the shared control clock.
+    if (mAcceleration == 0. && mDeceleration == 0. && !pending
+        && !(mController && mController->congested())) {
+        sendSpeed(mSpeedRequest);
     }
+    mClock->subscribe(this);
 }
 
-void Track::emitCommand()
+void Track::commandSpeed(float speed, qint64 deviceTime)
 {
-    emit speedRequest(int(mSpeedRequest * mDefinition.mMaxSpeed));
-    mDelay.stop();
+    if (!mLinked)
+        return;
+
+    mSpeedRequest = speed;
+    if (deviceTime >= 0 && mController && mController->supports(Frame::SCHEDULED)) {
+        mSent = true;
+        mSpeedCommand = speed;
+        mLastCommand = int(speed * mDefinition.mMaxSpeed);
+        Protocol::ScheduledSpeed::Buffer buffer;
+        mController->send(buffer, Protocol::ScheduledSpeed::encode(buffer, id(), mLastCommand,
+                                                                  quint64(deviceTime)));
+        emit speedRequest(mLastCommand);
+    } else {
+        sendSpeed(speed);
+    }
+    // Let the clock release a pending ramp, and run the prediction.
+    if (mClock)
+        mClock->subscribe(this);
+}
+
+void Track::cancelCommands()
+{
+    if (mClock)
+        mClock->unsubscribe(this);
+    mSpeedRequest = 0.;
+    mSpeedCommand = 0.;
+    mLastCommand = 0;
+    mSent = false;
+}
+
+void Track::resendCommand()
+{
+    if (mLinked)
+        sendSpeed(mSpeedCommand);
+}
+
+void Track::sendSpeed(float speed)
+{
+    mSent = true;
+    mSpeedCommand = speed;
+    mLastCommand = int(speed * mDefinition.mMaxSpeed);
+    if (mController) {
+        Protocol::SpeedCommand::Buffer buffer;
+        mController->send(buffer, Protocol::SpeedCommand::encode(buffer, id(), mLastCommand));
+    }
+    emit speedRequest(mLastCommand);
+}
+
+bool Track::step(float interval)
+{
+    const bool commanding = stepCommand(interval);
+    const bool predicting = mPrediction && predict();
+    return commanding || predicting;
+}
+
+void Track::advance(qint64 time)
+{
+    if (time > mEstimateTime)
+        mOdometer += qAbs(mEstimate) * float(time - mEstimateTime) / 1000.f;
+    mEstimateTime = time;
+}
+
+bool Track::predict()
+{
+    // Without control, the track keeps its reported speed.
+    const float target = mLinked ? mSpeedCommand
+        : (mState.mDirection == BACKWARD ? -speed() : speed());
+    const qint64 now = History::now();
+    const float elapsed = float(now - mEstimateTime) / 1000.f;
+    advance(now);
+    if (mEstimate != target) {
+        mEstimate += (target - mEstimate) * (1.f - std::exp(-elapsed / PREDICTION_LAG));
+        if (qAbs(target - mEstimate) * mDefinition.mMaxSpeed < 1.f)
+            mEstimate = target;
+        emit estimateChanged();
+    }
+    // Keep ticking while moving, for the odometer.
+    return mEstimate != 0. || target != 0.;
+}
+
+bool Track::stepCommand(float interval)
+{
+    const float current = mSpeedCommand;
+    const float target = mSpeedRequest;
+    // Nothing was sent during the last tick, release the track.
+    if (current == target && !mSent)
+        return false;
+    mSent = false;
+    if (current == target)
+        return true;
+    // Hold commands back while the link is congested, only the
+    // latest request will be sent.
+    if (mController && mController->congested())
+        return true;
+
+    // Braking is any change toward zero, including the first half of
+    // a direction reversal, which stops at zero before accelerating
+    // when ramped. Without a ramp, a reversal is sent at once.
+    const bool braking = (current > 0. && target < current)
+        || (current < 0. && target > current);
+    const float rate = braking ? mDeceleration : mAcceleration;
+    float next = target;
+    if (rate > 0.) {
+        const float delta = rate * interval;
+        if (target > current) {
+            next = qMin(current + delta, target);
+        } else {
+            next = qMax(current - delta, target);
+        }
+        if (braking && ((current > 0. && next < 0.) || (current < 0. && next > 0.))) {
+            next = 0.;
+        }
+    }
+
+    if (int(next * mDefinition.mMaxSpeed) != mLastCommand) {
+        sendSpeed(next);
+    } else {
+        mSpeedCommand = next;
+    }
+    return true;
 }
 
 Track::Definition::Definition()
@@ -145,13 +439,24 @@ Track::Definition::Definition(QDataStream &in)
     quint32 ln = 0;
     in >> ln;
     ln = qFromBigEndian<quint32>(ln);
-    char *label = new char[ln + 1];
-    in.readRawData(label, ln + 1);
-    mLabel = QString::fromUtf8(label);
-    delete[] label;
+    // The label is NUL terminated on the wire.
+    if (in.status() != QDataStream::Ok || ln > MAX_LABEL) {
+        in.setStatus(QDataStream::ReadCorruptData);
+        return;
+    }
+    QByteArray label(int(ln) + 1, '\0');
+    if (in.readRawData(label.data(), label.length()) != label.length()) {
+        in.setStatus(QDataStream::ReadPastEnd);
+        return;
+    }
+    mLabel = QString::fromUtf8(label.constData());
     quint32 maxSpeed = 4096;
     in >> maxSpeed;
     mMaxSpeed = qFromBigEndian<quint32>(maxSpeed);
+    if (mMaxSpeed <= 0) {
+        in.setStatus(QDataStream::ReadCorruptData);
+        return;
+    }
     quint16 cap = 0;
     in >> cap;
     cap = qFromBigEndian<quint16>(cap);
@@ -167,36 +472,28 @@ Track::State::State()
 {
 }
 
-Track::State::State(QDataStream &in)
+Track::State::State(qint32 isForward, qint32 isBackward, qint32 speed,
+                    quint32 count, qint32 position)
 {
-    qint32 isForward, isBackward;
-    in >> isForward >> isBackward;
     mDirection = Track::IDLE;
-    if (qFromBigEndian<qint32>(isForward)) {
+    if (isForward) {
         mDirection = Track::FORWARD;
     }
-    if (qFromBigEndian<qint32>(isBackward)) {
+    if (isBackward) {
         mDirection = Track::BACKWARD;
     }
-    qint32 speed;
-    in >> speed;
-    mSpeed = qFromBigEndian<qint32>(speed);
-    quint32 count;
-    in >> count;
-    mCount = qFromBigEndian<quint32>(count);
-    qint32 state;
-    in >> state;
-    state = qFromBigEndian<qint32>(state);
+    mSpeed = speed;
+    mCount = count;
     mPosition = Track::SOMEWHERE;
-    if (state == 1) {
+    if (position == 1) {
         mPosition = Track::APPROACHING;
-    } else if (state == 2) {
+    } else if (position == 2) {
         mPosition = Track::PASSING_BY;
-    } else if (state == 3) {
+    } else if (position == 3) {
         mPosition = Track::STOPPING;
-    } else if (state == 4) {
+    } else if (position == 4) {
         mPosition = Track::IN_STATION;
-    } else if (state == 5) {
+    } else if (position == 5) {
         mPosition = Track::LEAVING;
     }
 }
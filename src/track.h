@@ -9,7 +9,11 @@
 
 #include <QObject>
 #include <QDataStream>
-#include <QTimer>
+
+#include "history.h"
+
+class ControlClock;
+class Controller;
 
 class Track: public QObject
 {
@@ -21,6 +25,14 @@ class Track: public QObject
     Q_PROPERTY(int count READ count NOTIFY countChanged);
     Q_PROPERTY(Position position READ position NOTIFY positionChanged);
     Q_PROPERTY(bool linked READ linked NOTIFY linkedChanged);
+    Q_PROPERTY(float acceleration READ acceleration WRITE setAcceleration NOTIFY accelerationChanged);
+    Q_PROPERTY(float deceleration READ deceleration WRITE setDeceleration NOTIFY decelerationChanged);
+    Q_PROPERTY(bool focused READ focused WRITE setFocused NOTIFY focusedChanged);
+    Q_PROPERTY(bool watched READ watched WRITE setWatched NOTIFY watchedChanged);
+    Q_PROPERTY(bool prediction READ prediction WRITE setPrediction NOTIFY predictionChanged);
+    Q_PROPERTY(float estimatedSpeed READ estimatedSpeed NOTIFY estimateChanged);
+    Q_PROPERTY(float odometer READ odometer NOTIFY estimateChanged);
+    Q_PROPERTY(float lapProgress READ lapProgress NOTIFY estimateChanged);
 
  public:
     enum Direction
@@ -55,7 +67,9 @@ class Track: public QObject
     {
     public:
         Definition();
+        // Reading a malformed definition sets the status of in.
         Definition(QDataStream &in);
+        static const quint32 MAX_LABEL = 1024;
     private:
         friend class Track;
         int mId = -1;
@@ -68,7 +82,8 @@ class Track: public QObject
     {
     public:
         State();
-        State(QDataStream &in);
+        State(qint32 isForward, qint32 isBackward, qint32 speed,
+              quint32 count, qint32 position);
     private:
         friend class Track;
         Direction mDirection = Track::IDLE;
@@ -80,24 +95,74 @@ class Track: public QObject
 
  public:
     Track(QObject *parent = nullptr);
-    Track(const Definition &definition, QObject *parent = nullptr);
+    Track(const Definition &definition, Controller *controller);
     ~Track();
 
     int id() const;
     QString label() const;
+    // Full scale speed, in device units.
+    int maxSpeed() const;
     Capabilities capabilities() const;
     Direction direction() const;
     float speed() const;
     int count() const;
     Position position() const;
     bool linked() const;
-
-    void setState(const State &state);
+    float requestedSpeed() const;
+
+    // Ramp profiles, in full scale (the track maximum speed) per
+    // second. A null value applies speed changes at once.
+    float acceleration() const;
+    void setAcceleration(float acceleration);
+    float deceleration() const;
+    void setDeceleration(float deceleration);
+
+    // Whether the track is being driven from the UI, and whether it
+    // is displayed at all. They drive the state report rate.
+    bool focused() const;
+    void setFocused(bool focused);
+    bool watched() const;
+    void setWatched(bool watched);
+
+    // Interval, in milliseconds, between two state reports requested
+    // from the device, 0 leaving it to the firmware.
+    int reportInterval() const;
+    void setReportInterval(int interval);
+
+    // Between two state reports, the speed is extrapolated on the
+    // control clock ticks toward the commanded one, with a first
+    // order lag of PREDICTION_LAG seconds. Reports correct it.
+    static constexpr float PREDICTION_LAG = 0.3f;
+    bool prediction() const;
+    void setPrediction(bool prediction);
+    float estimatedSpeed() const;
+    // Estimated travelled distance, in full scale speed times seconds,
+    // and estimated ratio of the current lap, from the distance of
+    // the previous one between two passages. The latter is 0 until
+    // a lap has been completed. Both are notified with the estimated
+    // speed only, which stays put at steady speed: read them on demand.
+    float odometer() const;
+    float lapProgress() const;
+
+    const History& history() const;
+
+    // time is when the state was reached, in History::nowUs() time,
+    // -1 meaning on arrival.
+    void setState(const State &state, qint64 time = -1);
+    qint64 stateTime() const;
+    void setClock(ControlClock *clock);
+    bool step(float interval);
 
     Q_INVOKABLE void acquire();
     Q_INVOKABLE void release();
     void setLinked(bool linked);
     Q_INVOKABLE void requestSpeed(float speed);
+    // Speed command for a group of tracks, neither ramped nor
+    // throttled, applied at deviceTime in µs when the device supports
+    // SCHEDULED commands, at once otherwise.
+    void commandSpeed(float speed, qint64 deviceTime = -1);
+    void cancelCommands();
+    void resendCommand();
 
  signals:
     void directionChanged();
@@ -105,19 +170,44 @@ class Track: public QObject
     void countChanged();
     void positionChanged();
     void linkedChanged();
+    void historyChanged();
+    void accelerationChanged();
+    void decelerationChanged();
+    void focusedChanged();
+    void watchedChanged();
+    void predictionChanged();
+    void estimateChanged();
 
-    void acquireRequest();
-    void releaseRequest();
     void speedRequest(int speed);
 
  private:
-    void emitCommand();
+    void sendSpeed(float speed);
+    bool stepCommand(float interval);
+    bool predict();
+    void advance(qint64 time);
 
+    Controller *mController = nullptr;
     Definition mDefinition;
     State mState;
+    History mHistory;
     bool mLinked = false;
     float mSpeedRequest = 0.;
-    QTimer mDelay;
+    float mSpeedCommand = 0.;
+    int mLastCommand = 0;
+    float mAcceleration = 0.;
+    float mDeceleration = 0.;
+    ControlClock *mClock = nullptr;
+    bool mSent = false;
+    bool mFocused = false;
+    bool mWatched = false;
+    int mReportInterval = 0;
+    qint64 mStateTime = 0;
+    bool mPrediction = false;
+    float mEstimate = 0.;
+    qint64 mEstimateTime = 0;
+    float mOdometer = 0.;
+    float mLapStart = -1.;
+    float mLapLength = 0.;
 };
 
 #endif
@@ -0,0 +1,385 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "trackoverview.h"
+
+#include <QElapsedTimer>
+#include <QSGGeometryNode>
+#include <QSGVertexColorMaterial>
+#include <QSGTextureMaterial>
+#include <QQuickWindow>
+#include <QPainter>
+#include <QImage>
+
+// Each track is drawn as three quads, the background bar, the speed
+// bar and the position marker, of two triangles each.
+static const int VERTICES_PER_TRACK = 3 * 6;
+// Labels are not drawn below this height, in pixels. They are packed
+// in columns in the texture, within the smallest maximum texture size
+// of the GPUs around.
+static const int MIN_LABEL_HEIGHT = 8;
+static const int MAX_TEXTURE_SIZE = 2048;
+
+// The labels of all tracks, one quad each, from one texture.
+class LabelNode: public QSGGeometryNode
+{
+public:
+    LabelNode()
+        : mGeometry(QSGGeometry::defaultAttributes_TexturedPoint2D(), 0)
+    {
+        mGeometry.setDrawingMode(QSGGeometry::DrawTriangles);
+        setGeometry(&mGeometry);
+        // Text is antialiased against a transparent background.
+        mMaterial.setFlag(QSGMaterial::Blending);
+        setMaterial(&mMaterial);
+    }
+    ~LabelNode()
+    {
+        delete mMaterial.texture();
+    }
+
+    void setTexture(QSGTexture *texture)
+    {
+        delete mMaterial.texture();
+        mMaterial.setTexture(texture);
+        markDirty(QSGNode::DirtyMaterial);
+    }
+
+    QSGGeometry mGeometry;
+    QSGTextureMaterial mMaterial;
+};
+
+static void setQuad(QSGGeometry::ColoredPoint2D *vertices,
+                    const QRectF &rect, const QColor &color, qreal opacity)
+{
+    // The vertex color material expects premultiplied colors.
+    const qreal alpha = color.alphaF() * opacity;
+    const uchar r = uchar(color.red() * alpha);
+    const uchar g = uchar(color.green() * alpha);
+    const uchar b = uchar(color.blue() * alpha);
+    const uchar a = uchar(255 * alpha);
+    const float left = rect.left();
+    const float top = rect.top();
+    const float right = rect.right();
+    const float bottom = rect.bottom();
+    vertices[0].set(left, top, r, g, b, a);
+    vertices[1].set(right, top, r, g, b, a);
+    vertices[2].set(left, bottom, r, g, b, a);
+    vertices[3].set(right, top, r, g, b, a);
+    vertices[4].set(right, bottom, r, g, b, a);
+    vertices[5].set(left, bottom, r, g, b, a);
+}
+
+TrackOverview::TrackOverview(QQuickItem *parent)
+    : QQuickItem(parent)
+{
+    setFlag(QQuickItem::ItemHasContents, true);
+}
+
+TrackOverview::~TrackOverview()
+{
+}
+
+QVariantList TrackOverview::tracks() const
+{
+    QVariantList list;
+    for (const QPointer<Track> &track : mTracks) {
+        if (track)
+            list.append(QVariant::fromValue(track.data()));
+    }
+    return list;
+}
+
+static void setTexturedQuad(QSGGeometry::TexturedPoint2D *vertices,
+                            const QRectF &rect, const QRectF &source)
+{
+    vertices[0].set(rect.left(), rect.top(), source.left(), source.top());
+    vertices[1].set(rect.right(), rect.top(), source.right(), source.top());
+    vertices[2].set(rect.left(), rect.bottom(), source.left(), source.bottom());
+    vertices[3].set(rect.right(), rect.top(), source.right(), source.top());
+    vertices[4].set(rect.right(), rect.bottom(), source.right(), source.bottom());
+    vertices[5].set(rect.left(), rect.bottom(), source.left(), source.bottom());
+}
+
+void TrackOverview::setTracks(const QVariantList &tracks)
+{
+    for (const QPointer<Track> &track : mTracks) {
+        if (track)
+            QObject::disconnect(track.data(), nullptr, this, nullptr);
+    }
+    mTracks.clear();
+    for (const QVariant &value : tracks) {
+        Track *track = qobject_cast<Track*>(value.value<QObject*>());
+        if (!track)
+            continue;
+        const int index = mTracks.size();
+        mTracks.append(track);
+        connect(track, &Track::directionChanged,
+                this, [this, index] () {invalidate(index);});
+        connect(track, &Track::estimateChanged,
+                this, [this, index] () {invalidate(index);});
+        connect(track, &Track::positionChanged,
+                this, [this, index] () {invalidate(index);});
+        connect(track, &Track::countChanged,
+                this, &TrackOverview::invalidateLabels);
+        connect(track, &Track::linkedChanged,
+                this, &TrackOverview::invalidateLabels);
+        connect(track, &QObject::destroyed,
+                this, [this, index] () {
+                    invalidate(index);
+                    invalidateLabels();
+                });
+    }
+    mDirty.fill(false, mTracks.size());
+    invalidateAll();
+    emit tracksChanged();
+}
+
+QColor TrackOverview::color() const
+{
+    return mColor;
+}
+
+void TrackOverview::setColor(const QColor &color)
+{
+    if (color == mColor)
+        return;
+
+    mColor = color;
+    invalidateAll();
+    emit colorChanged();
+}
+
+QColor TrackOverview::highlightColor() const
+{
+    return mHighlightColor;
+}
+
+void TrackOverview::setHighlightColor(const QColor &color)
+{
+    if (color == mHighlightColor)
+        return;
+
+    mHighlightColor = color;
+    invalidateAll();
+    emit highlightColorChanged();
+}
+
+Track* TrackOverview::current() const
+{
+    return mCurrent;
+}
+
+void TrackOverview::setCurrent(Track *track)
+{
+    if (track == mCurrent)
+        return;
+
+    mCurrent = track;
+    invalidateLabels();
+    emit currentChanged();
+}
+
+int TrackOverview::indexAt(qreal y) const
+{
+    if (mTracks.isEmpty() || y < 0. || y >= height())
+        return -1;
+    return qMin(mTracks.size() - 1, int(y * mTracks.size() / height()));
+}
+
+Track* TrackOverview::trackAt(qreal y) const
+{
+    const int index = indexAt(y);
+    return index < 0 ? nullptr : mTracks.at(index).data();
+}
+
+int TrackOverview::updateTime() const
+{
+    return mUpdateTime;
+}
+
+bool TrackOverview::paused() const
+{
+    return mPaused;
+}
+
+void TrackOverview::setPaused(bool paused)
+{
+    if (paused == mPaused)
+        return;
+
+    mPaused = paused;
+    // Catch up with the changes accumulated while paused, or draw the
+    // last state before pausing.
+    mFinalFrame = mPaused;
+    update();
+    emit pausedChanged();
+}
+
+void TrackOverview::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChanged(newGeometry, oldGeometry);
+    if (newGeometry.size() != oldGeometry.size())
+        invalidateAll();
+}
+
+void TrackOverview::invalidate(int index)
+{
+    if (index < mDirty.size())
+        mDirty[index] = true;
+    scheduleUpdate();
+}
+
+void TrackOverview::invalidateLabels()
+{
+    mLabelsDirty = true;
+    scheduleUpdate();
+}
+
+void TrackOverview::invalidateAll()
+{
+    mAllDirty = true;
+    mLabelsDirty = true;
+    scheduleUpdate();
+}
+
+void TrackOverview::scheduleUpdate()
+{
+    if (!mPaused || mFinalFrame)
+        update();
+}
+
+void TrackOverview::updateLabels(QSGGeometryNode *node)
+{
+    LabelNode *labels = static_cast<LabelNode*>(node);
+    mLabelsDirty = false;
+
+    // The labels take the free third of a row, above the bars.
+    const int count = mTracks.size();
+    const qreal rowHeight = count ? height() / count : 0.;
+    const int lineHeight = int(rowHeight / 3.);
+    const int lineWidth = int(width() - qMin(rowHeight / 3., width() / 10.) - rowHeight / 6.);
+    if (lineHeight < MIN_LABEL_HEIGHT || lineWidth <= 0) {
+        labels->mGeometry.allocate(0);
+        labels->markDirty(QSGNode::DirtyGeometry);
+        return;
+    }
+
+    const int perColumn = qMax(1, MAX_TEXTURE_SIZE / lineHeight);
+    const int columns = (count + perColumn - 1) / perColumn;
+    QImage image(columns * lineWidth, qMin(count, perColumn) * lineHeight,
+                 QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    QPainter painter(&image);
+    QFont font = painter.font();
+    font.setPixelSize(qMax(1, lineHeight * 4 / 5));
+    painter.setFont(font);
+    labels->mGeometry.allocate(count * 6);
+    QSGGeometry::TexturedPoint2D *vertices = labels->mGeometry.vertexDataAsTexturedPoint2D();
+    for (int i = 0; i < count; i++) {
+        const QRect source((i / perColumn) * lineWidth, (i % perColumn) * lineHeight,
+                           lineWidth, lineHeight);
+        setTexturedQuad(vertices + i * 6, QRectF(0., i * rowHeight, lineWidth, lineHeight),
+                        QRectF(qreal(source.x()) / image.width(), qreal(source.y()) / image.height(),
+                               qreal(source.width()) / image.width(),
+                               qreal(source.height()) / image.height()));
+        Track *track = mTracks.at(i).data();
+        if (!track)
+            continue;
+        QString text = track->label();
+        if (track->capabilities() & Track::POSITIONING)
+            text += QString::fromLatin1(" | %1 passage(s)").arg(track->count());
+        QColor color = track == mCurrent ? mHighlightColor : mColor;
+        if (!track->linked())
+            color.setAlphaF(color.alphaF() * 0.6);
+        painter.setPen(color);
+        painter.drawText(source, Qt::AlignLeft | Qt::AlignVCenter,
+                         painter.fontMetrics().elidedText(text, Qt::ElideRight, lineWidth));
+    }
+    painter.end();
+    labels->setTexture(window()->createTextureFromImage(image));
+    labels->markDirty(QSGNode::DirtyGeometry);
+}
+
+QSGNode* TrackOverview::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data)
+{
+    Q_UNUSED(data);
+
+    mFinalFrame = false;
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    QSGGeometryNode *node = static_cast<QSGGeometryNode*>(oldNode);
+    const int vertexCount = mTracks.size() * VERTICES_PER_TRACK;
+    if (!node) {
+        node = new QSGGeometryNode;
+        QSGGeometry *geometry = new QSGGeometry(QSGGeometry::defaultAttributes_ColoredPoint2D(),
+                                                vertexCount);
+        geometry->setDrawingMode(QSGGeometry::DrawTriangles);
+        node->setGeometry(geometry);
+        node->setFlag(QSGNode::OwnsGeometry);
+        node->setMaterial(new QSGVertexColorMaterial);
+        node->setFlag(QSGNode::OwnsMaterial);
+        LabelNode *labels = new LabelNode;
+        node->appendChildNode(labels);
+        mAllDirty = true;
+        mLabelsDirty = true;
+    } else if (node->geometry()->vertexCount() != vertexCount) {
+        node->geometry()->allocate(vertexCount);
+        mAllDirty = true;
+    }
+
+    QSGGeometry::ColoredPoint2D *vertices = node->geometry()->vertexDataAsColoredPoint2D();
+    const qreal rowHeight = mTracks.isEmpty() ? 0. : height() / mTracks.size();
+    const qreal barHeight = rowHeight / 3.;
+    const qreal markerWidth = qMin(barHeight, width() / 10.);
+    const qreal barWidth = width() - markerWidth - barHeight / 2.;
+    for (int i = 0; i < mTracks.size(); i++) {
+        if (!mAllDirty && !mDirty[i])
+            continue;
+        mDirty[i] = false;
+
+        QSGGeometry::ColoredPoint2D *at = vertices + i * VERTICES_PER_TRACK;
+        Track *track = mTracks[i].data();
+        const qreal top = i * rowHeight + barHeight;
+        const QRectF background(0., top, barWidth, barHeight);
+        if (!track) {
+            setQuad(at, background, mColor, 0.);
+            setQuad(at + 6, background, mColor, 0.);
+            setQuad(at + 12, background, mColor, 0.);
+            continue;
+        }
+        setQuad(at, background, mColor, 0.2);
+        const qreal speed = qBound(0., qreal(track->estimatedSpeed()), 1.) * barWidth;
+        const QRectF bar = track->direction() == Track::BACKWARD
+            ? QRectF(barWidth - speed, top, speed, barHeight)
+            : QRectF(0., top, speed, barHeight);
+        setQuad(at + 6, bar, track->direction() == Track::IDLE ? mColor : mHighlightColor,
+                track->direction() == Track::IDLE ? 0.4 : 1.);
+        const QRectF marker(width() - markerWidth, top, markerWidth, barHeight);
+        switch (track->position()) {
+        case Track::SOMEWHERE:
+            setQuad(at + 12, marker, mColor, 0.);
+            break;
+        case Track::STOPPING:
+        case Track::IN_STATION:
+            setQuad(at + 12, marker, mHighlightColor, 1.);
+            break;
+        default:
+            setQuad(at + 12, marker, mColor, 0.6);
+            break;
+        }
+    }
+    mAllDirty = false;
+    node->markDirty(QSGNode::DirtyGeometry);
+    if (mLabelsDirty)
+        updateLabels(static_cast<QSGGeometryNode*>(node->firstChild()));
+
+    mUpdateTime = int(elapsed.nsecsElapsed() / 1000);
+    QMetaObject::invokeMethod(this, "updateTimeChanged", Qt::QueuedConnection);
+
+    return node;
+}
@@ -0,0 +1,87 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef TRACKOVERVIEW_H
+#define TRACKOVERVIEW_H
+
+#include <QQuickItem>
+#include <QPointer>
+#include <QVector>
+#include <QColor>
+
+class QSGGeometryNode;
+
+#include "track.h"
+
+// Draw the direction, speed and position of many tracks as one
+// batched geometry. Only the vertices of the tracks that changed
+// since the last frame are rewritten. Labels and passage counts are
+// rendered once into a texture, again only when one of them changes.
+class TrackOverview: public QQuickItem
+{
+    Q_OBJECT
+    Q_PROPERTY(QVariantList tracks READ tracks WRITE setTracks NOTIFY tracksChanged)
+    Q_PROPERTY(QColor color READ color WRITE setColor NOTIFY colorChanged)
+    Q_PROPERTY(QColor highlightColor READ highlightColor WRITE setHighlightColor NOTIFY highlightColorChanged)
+    Q_PROPERTY(Track* current READ current WRITE setCurrent NOTIFY currentChanged)
+    Q_PROPERTY(int updateTime READ updateTime NOTIFY updateTimeChanged)
+    Q_PROPERTY(bool paused READ paused WRITE setPaused NOTIFY pausedChanged)
+
+ public:
+    TrackOverview(QQuickItem *parent = nullptr);
+    ~TrackOverview();
+
+    QVariantList tracks() const;
+    void setTracks(const QVariantList &tracks);
+    QColor color() const;
+    void setColor(const QColor &color);
+    QColor highlightColor() const;
+    void setHighlightColor(const QColor &color);
+    // The track labelled with the highlight color.
+    Track* current() const;
+    void setCurrent(Track *track);
+    int updateTime() const;
+    bool paused() const;
+    void setPaused(bool paused);
+
+    // The row at y, in item coordinates, -1 outside.
+    Q_INVOKABLE int indexAt(qreal y) const;
+    Q_INVOKABLE Track* trackAt(qreal y) const;
+
+ signals:
+    void tracksChanged();
+    void colorChanged();
+    void highlightColorChanged();
+    void currentChanged();
+    void updateTimeChanged();
+    void pausedChanged();
+
+ protected:
+    QSGNode* updatePaintNode(QSGNode *node, UpdatePaintNodeData *data) override;
+    void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry) override;
+
+ private:
+    void invalidate(int index);
+    void invalidateLabels();
+    void invalidateAll();
+    void scheduleUpdate();
+    void updateLabels(QSGGeometryNode *node);
+
+    QVector<QPointer<Track>> mTracks;
+    QVector<bool> mDirty;
+    bool mAllDirty = true;
+    bool mLabelsDirty = true;
+    QPointer<Track> mCurrent;
+    QColor mColor = Qt::white;
+    QColor mHighlightColor = Qt::cyan;
+    int mUpdateTime = 0;
+    bool mPaused = false;
+    // Changes still reach the scene graph until the first frame after
+    // pausing, the state that caused the pause arriving last.
+    bool mFinalFrame = false;
+};
+
+#endif
@@ -0,0 +1,456 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "emulateddevice.h"
+
+#include <QCoreApplication>
+#include <QLocalServer>
+#include <QSharedPointer>
+#include <QPointer>
+#include <QDebug>
+#include <QtEndian>
+
+#include "controller.h"
+#include "protocol.h"
+#include "history.h"
+#include "track.h"
+
+// Full scale speed times seconds of one loop, the station being at
+// its end.
+static const float LAP = 4.f;
+static const float APPROACH = 3.f;
+static const float STOPPING = 3.5f;
+static const float PASSING = 0.5f;
+static const int TICK = 10;
+static const int DEFAULT_INTERVAL = 200;
+
+static int sLinks = 0;
+
+template <typename T>
+static void append(QByteArray &data, T value)
+{
+    char buffer[sizeof(T)];
+    qToLittleEndian<T>(value, reinterpret_cast<uchar*>(buffer));
+    data.append(buffer, sizeof(T));
+}
+
+EmulatedDevice::EmulatedDevice(int tracks, quint32 features, QObject *parent)
+    : QObject(parent)
+    , mFeatures(features)
+    , mTracks(tracks)
+{
+    connect(&mTimer, &QTimer::timeout,
+            this, &EmulatedDevice::tick);
+}
+
+EmulatedDevice::~EmulatedDevice()
+{
+    unplug();
+}
+
+Controller* EmulatedDevice::connectController(const QString &address, QObject *parent)
+{
+    unplug();
+
+    const QString name = QString::fromLatin1("train-station-emulator-%1-%2")
+        .arg(QCoreApplication::applicationPid()).arg(sLinks++);
+    QLocalServer server;
+    QLocalServer::removeServer(name);
+    if (!server.listen(name)) {
+        qWarning() << "emulated device: cannot listen on" << name << server.errorString();
+        return nullptr;
+    }
+    mSocket = new QLocalSocket(this);
+    mSocket->connectToServer(name);
+    if (!mSocket->waitForConnected(1000) || !server.waitForNewConnection(1000)) {
+        qWarning() << "emulated device: cannot connect" << address << mSocket->errorString();
+        delete mSocket;
+        mSocket = nullptr;
+        return nullptr;
+    }
+    QLocalSocket *host = server.nextPendingConnection();
+    host->setParent(nullptr);
+    server.close();
+    connect(mSocket, &QIODevice::readyRead,
+            this, &EmulatedDevice::dataAvailable);
+    // Queued, the socket being closed from its own signal; a later
+    // link is left alone.
+    const QPointer<QLocalSocket> socket(mSocket);
+    connect(mSocket, &QLocalSocket::disconnected,
+            this, [this, socket] () {
+                if (socket && socket == mSocket)
+                    unplug();
+            }, Qt::QueuedConnection);
+
+    mEnabled = 0;
+    mInput.clear();
+    mOutput.clear();
+    mRxFraming = Framing();
+    mTxFraming = Framing();
+    mTracks.fill(TrackState());
+    mScheduled.clear();
+    mLastTick = time();
+    mTimer.start(TICK);
+
+    Controller *controller = new Controller(address, address, QString(),
+                                            QSharedPointer<QLocalSocket>(host), parent);
+
+    // Always sent plain, the features come last.
+    QByteArray capabilities;
+    append<quint32>(capabilities, Frame::CAPABILITIES);
+    append<quint32>(capabilities, quint32(mTracks.count()));
+    for (int id = 0; id < mTracks.count(); id++) {
+        const QByteArray label = address.toUtf8() + '/' + QByteArray::number(id);
+        append<quint32>(capabilities, quint32(id));
+        append<quint32>(capabilities, quint32(label.length()));
+        capabilities.append(label.constData(), label.length() + 1);
+        append<quint32>(capabilities, quint32(MAX_SPEED));
+        append<quint16>(capabilities, quint16(Track::SPEED_CONTROL | Track::POSITIONING));
+    }
+    append<quint32>(capabilities, mFeatures);
+    mSocket->write(capabilities);
+    mSocket->flush();
+    return controller;
+}
+
+void EmulatedDevice::unplug()
+{
+    if (!mSocket)
+        return;
+
+    mTimer.stop();
+    QObject::disconnect(mSocket, nullptr, this, nullptr);
+    mSocket->abort();
+    mSocket->deleteLater();
+    mSocket = nullptr;
+    emit unplugged();
+}
+
+bool EmulatedDevice::plugged() const
+{
+    return mSocket;
+}
+
+void EmulatedDevice::sendGarbage(Garbage kind)
+{
+    if (!mSocket)
+        return;
+
+    switch (kind) {
+    case TRUNCATED: {
+        Protocol::TrackState::Buffer buffer;
+        Protocol::TrackState::encode(buffer, 0, 1, 0, 100, 0, 0);
+        send(buffer, 10);
+        break;
+    }
+    case UNKNOWN_TYPE: {
+        QByteArray frame;
+        append<quint32>(frame, 0xBADC0DE);
+        append<quint64>(frame, 0);
+        send(frame.constData(), frame.length());
+        break;
+    }
+    case UNKNOWN_TRACK: {
+        Protocol::TrackState::Buffer buffer;
+        send(buffer, Protocol::TrackState::encode(buffer, 9999, 1, 0, 100, 0, 0));
+        break;
+    }
+    case BAD_CAPABILITIES: {
+        QByteArray frame;
+        append<quint32>(frame, Frame::CAPABILITIES);
+        append<quint32>(frame, 0xFFFFFFFF);
+        append<quint32>(frame, 0);
+        append<quint32>(frame, 0x7FFFFFFF);
+        send(frame.constData(), frame.length());
+        break;
+    }
+    case CORRUPTED:
+        if (mEnabled & Frame::FRAMING) {
+            Protocol::TrackState::Buffer buffer;
+            QByteArray data = mTxFraming.wrap(buffer, Protocol::TrackState::encode(buffer, 0, 1, 0, 100, 0, 0));
+            data[8] = char(data.at(8) ^ 0x40);
+            mSocket->write(data);
+            break;
+        }
+        // Plain frames have no check to break.
+        // fall through
+    case NOISE: {
+        QByteArray data(1 + qrand() % 64, Qt::Uninitialized);
+        for (int i = 0; i < data.length(); i++)
+            data[i] = char(qrand());
+        mSocket->write(data);
+        break;
+    }
+    }
+}
+
+void EmulatedDevice::sendPing()
+{
+    Protocol::Ping::Buffer buffer;
+    send(buffer, Protocol::Ping::encode(buffer, ++mPingCount));
+}
+
+void EmulatedDevice::setClockOffset(qint64 offset)
+{
+    mClockOffset = offset;
+}
+
+qint64 EmulatedDevice::time() const
+{
+    return History::nowUs() + mClockOffset;
+}
+
+int EmulatedDevice::tracks() const
+{
+    return mTracks.count();
+}
+
+int EmulatedDevice::speed(int id) const
+{
+    return mTracks.value(id).mSpeed;
+}
+
+bool EmulatedDevice::linked(int id) const
+{
+    return mTracks.value(id).mLinked;
+}
+
+bool EmulatedDevice::framed() const
+{
+    return mEnabled & Frame::FRAMING;
+}
+
+int EmulatedDevice::commands() const
+{
+    return mCommands;
+}
+
+int EmulatedDevice::scheduled() const
+{
+    return mScheduled.count();
+}
+
+int EmulatedDevice::pings() const
+{
+    return mPings;
+}
+
+int EmulatedDevice::frameSize(quint32 type) const
+{
+    switch (type) {
+    case Frame::PING:
+        return Protocol::Ping::SIZE;
+    case Frame::ACQUIRE_TRACK:
+        return Protocol::AcquireTrack::SIZE;
+    case Frame::RELEASE_TRACK:
+        return Protocol::ReleaseTrack::SIZE;
+    case Frame::SPEED_COMMAND:
+        return Protocol::SpeedCommand::SIZE;
+    case Frame::PROTOCOL:
+        return Protocol::Features::SIZE;
+    case Frame::STATE_REQUEST:
+        return Protocol::StateRequest::SIZE;
+    case Frame::REPORT_INTERVAL:
+        return Protocol::ReportInterval::SIZE;
+    case Frame::TIME_REQUEST:
+        return Protocol::TimeRequest::SIZE;
+    case Frame::SCHEDULED_SPEED:
+        return Protocol::ScheduledSpeed::SIZE;
+    default:
+        return 0;
+    }
+}
+
+void EmulatedDevice::dataAvailable()
+{
+    mInput.append(mSocket->readAll());
+    // Plain frames are delimited by their type, up to PROTOCOL
+    // enabling FRAMING in the middle of the data.
+    while (!(mEnabled & Frame::FRAMING)) {
+        if (mInput.length() < int(sizeof(quint32)))
+            return;
+        const quint32 type = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(mInput.constData()));
+        const int size = frameSize(type);
+        if (!size) {
+            qWarning() << "emulated device: unknown frame" << type << ", dropping input";
+            mInput.clear();
+            return;
+        }
+        if (mInput.length() < size)
+            return;
+        const QByteArray frame = mInput.left(size);
+        mInput.remove(0, size);
+        readFrame(frame);
+    }
+
+    mRxFraming.feed(mInput);
+    mInput.clear();
+    QByteArray payload;
+    while (mRxFraming.next(&payload)) {
+        readFrame(payload);
+    }
+    // Nothing gets lost on a local socket.
+    if (mRxFraming.takeResync())
+        qWarning() << "emulated device: host frames lost";
+}
+
+void EmulatedDevice::readFrame(const QByteArray &frame)
+{
+    const char *pt = frame.constData();
+    const int length = frame.length();
+    quint64 count, when;
+    quint32 id, value;
+    qint32 speed;
+    if (Protocol::Ping::decode(pt, length, count)) {
+        mPings += 1;
+    } else if (Protocol::AcquireTrack::decode(pt, length, id)) {
+        const bool ack = id < quint32(mTracks.count());
+        if (ack)
+            mTracks[id].mLinked = true;
+        Protocol::AcquireAck::Buffer buffer;
+        send(buffer, Protocol::AcquireAck::encode(buffer, id, ack));
+    } else if (Protocol::ReleaseTrack::decode(pt, length, id)) {
+        const bool ack = id < quint32(mTracks.count());
+        if (ack)
+            mTracks[id].mLinked = false;
+        Protocol::ReleaseAck::Buffer buffer;
+        send(buffer, Protocol::ReleaseAck::encode(buffer, id, ack));
+    } else if (Protocol::SpeedCommand::decode(pt, length, id, speed)) {
+        // An immediate command supersedes the scheduled ones.
+        for (int i = mScheduled.count() - 1; i >= 0; i--) {
+            if (mScheduled.at(i).mId == id)
+                mScheduled.removeAt(i);
+        }
+        applySpeed(id, speed);
+    } else if (Protocol::ScheduledSpeed::decode(pt, length, id, speed, when)) {
+        if (qint64(when) <= time()) {
+            applySpeed(id, speed);
+        } else {
+            Scheduled scheduled = {id, speed, qint64(when)};
+            mScheduled.append(scheduled);
+        }
+    } else if (Protocol::Features::decode(pt, length, value)) {
+        mEnabled = value & mFeatures;
+        if (mEnabled & Frame::FRAMING) {
+            while (!mOutput.isEmpty()) {
+                const QByteArray frame = mOutput.takeFirst();
+                send(frame.constData(), frame.length());
+            }
+        }
+    } else if (Protocol::StateRequest::decode(pt, length)) {
+        for (int i = 0; i < mTracks.count(); i++) {
+            sendState(quint32(i));
+        }
+    } else if (Protocol::ReportInterval::decode(pt, length, id, value)) {
+        if (id < quint32(mTracks.count()))
+            mTracks[id].mInterval = value ? int(value) : DEFAULT_INTERVAL;
+    } else if (Protocol::TimeRequest::decode(pt, length, when)) {
+        const qint64 received = time();
+        Protocol::TimeReply::Buffer buffer;
+        send(buffer, Protocol::TimeReply::encode(buffer, when, quint64(received),
+                                                 quint64(time())));
+    } else {
+        qWarning() << "emulated device: unexpected frame" << frame.toHex();
+    }
+}
+
+void EmulatedDevice::send(const char *data, int length)
+{
+    if (!mSocket)
+        return;
+
+    if (mEnabled & Frame::FRAMING) {
+        mSocket->write(mTxFraming.wrap(data, length));
+    } else {
+        // The host reads one plain frame at a time, like a first
+        // generation firmware they are sent one per tick.
+        mOutput.append(QByteArray(data, length));
+    }
+}
+
+void EmulatedDevice::applySpeed(quint32 id, qint32 speed)
+{
+    if (id >= quint32(mTracks.count()))
+        return;
+
+    // Stopping is always possible, driving needs the track acquired.
+    TrackState &track = mTracks[id];
+    if (speed && !track.mLinked)
+        return;
+    const int previous = track.mSpeed;
+    track.mSpeed = qBound(-MAX_SPEED, int(speed), int(MAX_SPEED));
+    mCommands += 1;
+    // Speed changes are reported at once, stamped when applied.
+    if (track.mSpeed != previous)
+        sendState(id);
+    emit speedApplied(int(id), track.mSpeed);
+}
+
+void EmulatedDevice::sendState(quint32 id)
+{
+    TrackState &track = mTracks[id];
+    track.mLastReport = time();
+    if (mEnabled & Frame::TIMESTAMPS) {
+        Protocol::StampedTrackState::Buffer buffer;
+        send(buffer, Protocol::StampedTrackState::encode(buffer, id, track.mSpeed > 0,
+                                                         track.mSpeed < 0, qAbs(track.mSpeed),
+                                                         quint32(track.mCount), track.mPosition,
+                                                         quint64(track.mLastReport)));
+    } else {
+        Protocol::TrackState::Buffer buffer;
+        send(buffer, Protocol::TrackState::encode(buffer, id, track.mSpeed > 0,
+                                                  track.mSpeed < 0, qAbs(track.mSpeed),
+                                                  quint32(track.mCount), track.mPosition));
+    }
+}
+
+void EmulatedDevice::tick()
+{
+    const qint64 now = time();
+    const float interval = float(now - mLastTick) / 1000000.f;
+    mLastTick = now;
+
+    for (int i = mScheduled.count() - 1; i >= 0; i--) {
+        const Scheduled scheduled = mScheduled.at(i);
+        if (scheduled.mTime <= now) {
+            mScheduled.removeAt(i);
+            applySpeed(scheduled.mId, scheduled.mSpeed);
+        }
+    }
+
+    for (int id = 0; id < mTracks.count(); id++) {
+        TrackState &track = mTracks[id];
+        const int position = track.mPosition;
+        if (track.mPosition == Track::IN_STATION) {
+            if (track.mSpeed) {
+                track.mPosition = Track::LEAVING;
+                track.mDistance = 0.;
+                track.mCount += 1;
+            }
+        } else if (track.mPosition == Track::STOPPING && !track.mSpeed) {
+            track.mPosition = Track::IN_STATION;
+        } else {
+            track.mDistance += float(qAbs(track.mSpeed)) / MAX_SPEED * interval;
+            if (track.mDistance >= LAP) {
+                track.mDistance -= LAP;
+                track.mCount += 1;
+                track.mPosition = Track::PASSING_BY;
+            } else if (track.mDistance >= STOPPING) {
+                track.mPosition = Track::STOPPING;
+            } else if (track.mDistance >= APPROACH) {
+                track.mPosition = Track::APPROACHING;
+            } else if (track.mDistance >= PASSING) {
+                track.mPosition = Track::SOMEWHERE;
+            }
+        }
+        if (track.mPosition != position
+            || now - track.mLastReport >= qint64(track.mInterval) * 1000)
+            sendState(quint32(id));
+    }
+
+    if (!mOutput.isEmpty() && mSocket)
+        mSocket->write(mOutput.takeFirst());
+}
@@ -0,0 +1,115 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef EMULATEDDEVICE_H
+#define EMULATEDDEVICE_H
+
+#include <QObject>
+#include <QLocalSocket>
+#include <QTimer>
+#include <QVector>
+#include <QList>
+
+#include "framing.h"
+
+class Controller;
+
+// The firmware side of the wire protocol, for tests: a device with a
+// number of tracks, speaking to a Controller over a local socket pair
+// instead of the Bluetooth serial link. Trains run on a loop with a
+// station, reported as the POSITIONING capability describes it.
+class EmulatedDevice: public QObject
+{
+    Q_OBJECT
+ public:
+    // Full scale speed of the emulated tracks.
+    static const int MAX_SPEED = 1000;
+
+    EmulatedDevice(int tracks, quint32 features, QObject *parent = nullptr);
+    ~EmulatedDevice();
+
+    // Plug the device into a new controller, the device state being
+    // reset, and announce the tracks. Return nullptr if the socket
+    // pair cannot be set up.
+    Controller* connectController(const QString &address, QObject *parent = nullptr);
+    // Close the link from the device side.
+    void unplug();
+    bool plugged() const;
+
+    enum Garbage
+        {
+         TRUNCATED,
+         UNKNOWN_TYPE,
+         UNKNOWN_TRACK,
+         BAD_CAPABILITIES,
+         CORRUPTED,
+         NOISE
+        };
+    void sendGarbage(Garbage kind);
+    void sendPing();
+
+    // Device minus host clock, in µs.
+    void setClockOffset(qint64 offset);
+    qint64 time() const;
+
+    int tracks() const;
+    int speed(int id) const;
+    bool linked(int id) const;
+    bool framed() const;
+    // Speed commands applied so far, and scheduled ones not applied yet.
+    int commands() const;
+    int scheduled() const;
+    int pings() const;
+
+ signals:
+    // A speed command, immediate or scheduled, reached the motor.
+    void speedApplied(int id, int speed);
+    void unplugged();
+
+ private:
+    struct TrackState
+    {
+        int mSpeed = 0;
+        bool mLinked = false;
+        int mCount = 0;
+        int mPosition = 0;
+        float mDistance = 0.;
+        int mInterval = 200;
+        qint64 mLastReport = 0;
+    };
+    struct Scheduled
+    {
+        quint32 mId;
+        qint32 mSpeed;
+        qint64 mTime;
+    };
+
+    void dataAvailable();
+    void readFrame(const QByteArray &frame);
+    int frameSize(quint32 type) const;
+    void send(const char *data, int length);
+    void applySpeed(quint32 id, qint32 speed);
+    void sendState(quint32 id);
+    void tick();
+
+    quint32 mFeatures;
+    quint32 mEnabled = 0;
+    QLocalSocket *mSocket = nullptr;
+    QByteArray mInput;
+    QList<QByteArray> mOutput;
+    Framing mRxFraming;
+    Framing mTxFraming;
+    QVector<TrackState> mTracks;
+    QList<Scheduled> mScheduled;
+    QTimer mTimer;
+    qint64 mLastTick = 0;
+    qint64 mClockOffset = 0;
+    quint64 mPingCount = 0;
+    int mCommands = 0;
+    int mPings = 0;
+};
+
+#endif
@@ -0,0 +1,524 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+// Many emulated devices and hub clients hammering the station for a
+// while, through the same Station wiring as InterConnect: random plugs and unplugs, acquire and release storms,
+// malformed and truncated frames, emergency stops. Throughput, slider
+// to motor latency and memory are reported every ten seconds, the run
+// fails if a train still moves after the final emergency stop. Meant
+// to be run from a sanitized build as well, see tests/README.md.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QLocalSocket>
+#include <QPointer>
+#include <QTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QHash>
+#include <QDebug>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+
+#include "emulateddevice.h"
+#include "controller.h"
+#include "station.h"
+#include "track.h"
+
+static const int TRACKS_PER_DEVICE = 4;
+static const int REPORT_INTERVAL = 10000;
+
+static bool sVerbose = false;
+static int sWarnings = 0;
+
+static void messageHandler(QtMsgType type, const QMessageLogContext &, const QString &message)
+{
+    // The station is chatty about every frame, warnings are expected
+    // from the garbage sent on purpose: they are only counted.
+    switch (type) {
+    case QtDebugMsg:
+    case QtInfoMsg:
+        if (!sVerbose)
+            return;
+        break;
+    case QtWarningMsg:
+        sWarnings += 1;
+        if (!sVerbose)
+            return;
+        break;
+    default:
+        break;
+    }
+    fprintf(stderr, "%s\n", qPrintable(message));
+    if (type == QtFatalMsg)
+        abort();
+}
+
+static double residentMemory()
+{
+    QFile statm(QStringLiteral("/proc/self/statm"));
+    if (!statm.open(QIODevice::ReadOnly))
+        return 0.;
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    return fields.count() > 1
+        ? fields.at(1).toDouble() * sysconf(_SC_PAGESIZE) / (1024. * 1024.) : 0.;
+}
+
+class Stress: public QObject
+{
+ public:
+    Stress(int devices, int clients, int duration, QObject *parent = nullptr);
+
+    void start();
+    int result() const;
+
+ private:
+    struct Link
+    {
+        EmulatedDevice *mDevice = nullptr;
+        QPointer<Controller> mController;
+        QString mAddress;
+    };
+    struct Request
+    {
+        qint64 mTime;
+        int mSpeed;
+    };
+
+    int linkIndex(const QString &address) const;
+    void plug(int index);
+    void drop(int index);
+    Track* randomTrack(bool linked, int *index = nullptr);
+    void drive();
+    void storm();
+    void churn();
+    void garbage();
+    void ping();
+    void group();
+    void emergencyStop();
+    void driveClients();
+    void connectClient(int index);
+    void report();
+    void finish();
+    void check();
+
+    QVector<Link> mLinks;
+    QVector<QLocalSocket*> mClients;
+    Station mStation;
+    QString mHubName;
+    int mDuration;
+    QList<QTimer*> mTimers;
+    QHash<QPair<int, int>, Request> mRequests;
+    QVector<qint64> mLatencies;
+    QElapsedTimer mElapsed;
+    qint64 mCommands = 0;
+    qint64 mReportedCommands = 0;
+    qint64 mHubBytes = 0;
+    qint64 mReportedHubBytes = 0;
+    int mTracksAdded = 0;
+    int mPlugs = 0;
+    int mDrops = 0;
+    int mGarbage = 0;
+    int mStops = 0;
+    double mFirstMemory = 0.;
+    double mPeakMemory = 0.;
+    int mResult = 0;
+};
+
+Stress::Stress(int devices, int clients, int duration, QObject *parent)
+    : QObject(parent)
+    , mLinks(devices)
+    , mClients(clients, nullptr)
+    , mHubName(QString::fromLatin1("train-station-stress-%1").arg(QCoreApplication::applicationPid()))
+    , mDuration(duration)
+{
+    // A mix of first generation devices and of devices with all the
+    // optional protocol features, with skewed clocks.
+    static const quint32 features[] =
+        {Frame::NO_FEATURE,
+         Frame::FRAMING | Frame::REPORT_RATE,
+         Frame::FRAMING | Frame::REPORT_RATE | Frame::TIMESTAMPS | Frame::SCHEDULED,
+         Frame::FRAMING | Frame::REPORT_RATE | Frame::TIMESTAMPS | Frame::SCHEDULED};
+    for (int i = 0; i < mLinks.count(); i++) {
+        Link &link = mLinks[i];
+        link.mAddress = QString::fromLatin1("00:00:00:00:%1:%2")
+            .arg(i / 256, 2, 16, QLatin1Char('0')).arg(i % 256, 2, 16, QLatin1Char('0'));
+        link.mDevice = new EmulatedDevice(TRACKS_PER_DEVICE, features[i % 4], this);
+        link.mDevice->setClockOffset(qint64(qrand() % 2000000) - 1000000);
+        connect(link.mDevice, &EmulatedDevice::speedApplied,
+                this, [this, i] (int id, int speed) {
+                    mCommands += 1;
+                    QHash<QPair<int, int>, Request>::Iterator request
+                        = mRequests.find(qMakePair(i, id));
+                    if (request != mRequests.end() && request->mSpeed == speed) {
+                        mLatencies.append(mElapsed.nsecsElapsed() / 1000 - request->mTime);
+                        mRequests.erase(request);
+                    }
+                });
+    }
+}
+
+int Stress::result() const
+{
+    return mResult;
+}
+
+void Stress::start()
+{
+    mElapsed.start();
+    mFirstMemory = residentMemory();
+    // The station closes the links without ping and reopens the lost
+    // ones, as it asks InterConnect to.
+    connect(&mStation, &Station::unresponsive,
+            this, [this] (Controller *controller) {drop(linkIndex(controller->address()));});
+    connect(&mStation, &Station::reconnect,
+            this, [this] (const QString &address) {
+                const int index = linkIndex(address);
+                if (index >= 0 && !mLinks.at(index).mDevice->plugged())
+                    plug(index);
+            });
+    if (!mStation.hub()->listen(mHubName)) {
+        mResult = 1;
+        QCoreApplication::exit(mResult);
+        return;
+    }
+    for (int i = 0; i < mLinks.count(); i++) {
+        plug(i);
+    }
+    for (int i = 0; i < mClients.count(); i++) {
+        connectClient(i);
+    }
+
+    const struct {
+        int mInterval;
+        void (Stress::*mAction)();
+    } actions[] =
+          {{20, &Stress::drive},
+           {30, &Stress::storm},
+           {250, &Stress::churn},
+           {100, &Stress::garbage},
+           {1000, &Stress::ping},
+           {2000, &Stress::group},
+           {5000, &Stress::emergencyStop},
+           {50, &Stress::driveClients},
+           {REPORT_INTERVAL, &Stress::report}};
+    for (const auto &action : actions) {
+        QTimer *timer = new QTimer(this);
+        connect(timer, &QTimer::timeout, this, action.mAction);
+        timer->start(action.mInterval);
+        mTimers.append(timer);
+    }
+    QTimer::singleShot(mDuration * 1000, this, &Stress::finish);
+}
+
+int Stress::linkIndex(const QString &address) const
+{
+    for (int i = 0; i < mLinks.count(); i++) {
+        if (mLinks.at(i).mAddress == address)
+            return i;
+    }
+    return -1;
+}
+
+void Stress::plug(int index)
+{
+    drop(index);
+    Link &link = mLinks[index];
+    Controller *controller = link.mDevice->connectController(link.mAddress, this);
+    if (!controller) {
+        qCritical() << "cannot plug" << link.mAddress;
+        mResult = 1;
+        return;
+    }
+    link.mController = controller;
+    mPlugs += 1;
+    mStation.addController(controller);
+    // After the station wired the track.
+    connect(controller, &Controller::trackAdded,
+            this, [this] (Track *track) {
+                mTracksAdded += 1;
+                if (qrand() % 4 == 0)
+                    mStation.timetable()->setStop(track, 200 + qrand() % 800, 0.5);
+                track->acquire();
+            });
+    // Queued, a new controller may be plugged meanwhile.
+    connect(controller, &Controller::linkLost,
+            this, [this, index, controller] () {
+                if (mLinks.at(index).mController == controller)
+                    drop(index);
+            });
+}
+
+void Stress::drop(int index)
+{
+    // As Spp does on a disconnection.
+    if (index < 0)
+        return;
+    Link &link = mLinks[index];
+    Controller *controller = link.mController;
+    if (!controller)
+        return;
+
+    link.mController.clear();
+    QObject::disconnect(controller, nullptr, this, nullptr);
+    mStation.removeController(controller);
+    for (Track *track : controller->tracks()) {
+        mRequests.remove(qMakePair(index, track->id()));
+    }
+    controller->deleteLater();
+    link.mDevice->unplug();
+    mDrops += 1;
+}
+
+Track* Stress::randomTrack(bool linked, int *index)
+{
+    const int at = qrand() % mLinks.count();
+    const Link &link = mLinks.at(at);
+    if (!link.mController || link.mController->tracks().isEmpty())
+        return nullptr;
+    const QList<Track*> tracks = link.mController->tracks();
+    Track *track = tracks.at(qrand() % tracks.count());
+    if (linked && !track->linked())
+        return nullptr;
+    if (index)
+        *index = at;
+    return track;
+}
+
+void Stress::drive()
+{
+    // Sliders being dragged on a quarter of the devices.
+    for (int i = 0; i < mLinks.count() / 4 + 1; i++) {
+        int index;
+        Track *track = randomTrack(true, &index);
+        if (!track)
+            continue;
+        const float speed = float(qrand() % 41 - 20) / 20.f;
+        if (speed == track->requestedSpeed())
+            continue;
+        Request request = {mElapsed.nsecsElapsed() / 1000,
+                           int(speed * EmulatedDevice::MAX_SPEED)};
+        mRequests.insert(qMakePair(index, track->id()), request);
+        track->requestSpeed(speed);
+        // Driving again re-arms a stop suspended by an emergency stop.
+        mStation.timetable()->resume(track);
+    }
+}
+
+void Stress::storm()
+{
+    for (int i = 0; i < mLinks.count() / 8 + 1; i++) {
+        Track *track = randomTrack(false);
+        if (!track)
+            continue;
+        if (track->linked()) {
+            track->release();
+        } else {
+            track->acquire();
+        }
+    }
+}
+
+void Stress::churn()
+{
+    const int index = qrand() % mLinks.count();
+    Link &link = mLinks[index];
+    if (!link.mDevice->plugged()) {
+        plug(index);
+    } else if (qrand() % 2) {
+        // Closed by the device, the controller notices.
+        link.mDevice->unplug();
+    } else {
+        // Closed by the station.
+        drop(index);
+    }
+}
+
+void Stress::garbage()
+{
+    const Link &link = mLinks.at(qrand() % mLinks.count());
+    if (link.mDevice->plugged()) {
+        link.mDevice->sendGarbage(EmulatedDevice::Garbage(qrand() % (EmulatedDevice::NOISE + 1)));
+        mGarbage += 1;
+    }
+}
+
+void Stress::ping()
+{
+    for (int i = 0; i < mLinks.count(); i++) {
+        const Link &link = mLinks.at(i);
+        if (link.mDevice->plugged())
+            link.mDevice->sendPing();
+    }
+}
+
+void Stress::group()
+{
+    QList<Track*> tracks;
+    for (int i = 0; i < 8; i++) {
+        Track *track = randomTrack(true);
+        if (track && !tracks.contains(track))
+            tracks.append(track);
+    }
+    mStation.groupSpeed(tracks, float(qrand() % 21 - 10) / 10.f);
+}
+
+void Stress::emergencyStop()
+{
+    mStops += 1;
+    mStation.emergencyStop();
+}
+
+void Stress::connectClient(int index)
+{
+    QLocalSocket *socket = new QLocalSocket(this);
+    connect(socket, &QIODevice::readyRead,
+            this, [this, socket] () {mHubBytes += socket->readAll().length();});
+    socket->connectToServer(mHubName);
+    mClients[index] = socket;
+}
+
+void Stress::driveClients()
+{
+    for (int i = 0; i < mClients.count(); i++) {
+        QLocalSocket *socket = mClients.at(i);
+        if (socket->state() == QLocalSocket::UnconnectedState) {
+            socket->deleteLater();
+            connectClient(i);
+            continue;
+        }
+        if (socket->state() != QLocalSocket::ConnectedState)
+            continue;
+
+        const quint32 index = quint32(qrand() % (mTracksAdded + 1));
+        const int action = qrand() % 100;
+        if (action < 30) {
+            Hub::Acquire::Buffer buffer;
+            socket->write(buffer, Hub::Acquire::encode(buffer, index));
+        } else if (action < 40) {
+            Hub::Release::Buffer buffer;
+            socket->write(buffer, Hub::Release::encode(buffer, index));
+        } else if (action < 96) {
+            // Out of range speeds included.
+            Hub::Speed::Buffer buffer;
+            socket->write(buffer, Hub::Speed::encode(buffer, index,
+                                                     qrand() % (4 * Hub::SPEED_SCALE + 1)
+                                                     - 2 * Hub::SPEED_SCALE));
+        } else if (action < 98) {
+            // An unknown message gets the client dropped.
+            const char garbage[] = {char(0xff), char(0xff), 0, 0, 1, 2, 3};
+            socket->write(garbage, sizeof(garbage));
+        } else {
+            socket->disconnectFromServer();
+        }
+    }
+}
+
+void Stress::report()
+{
+    const double seconds = mElapsed.elapsed() / 1000.;
+    int plugged = 0;
+    int tracks = 0;
+    double link = 0.;
+    for (const Link &entry : mLinks) {
+        if (entry.mController) {
+            plugged += 1;
+            tracks += entry.mController->tracks().count();
+            link += entry.mController->throughput();
+        }
+    }
+    std::sort(mLatencies.begin(), mLatencies.end());
+    const auto percentile = [this] (int p) {
+        return mLatencies.isEmpty() ? 0.
+            : mLatencies.at((mLatencies.count() - 1) * p / 100) / 1000.;
+    };
+    const double memory = residentMemory();
+    mPeakMemory = qMax(mPeakMemory, memory);
+
+    QTextStream out(stdout);
+    out << QString::asprintf("%5.0f s | %d/%d devices %d tracks | %.0f commands/s"
+                             " | link %.1f kB/s | hub %.1f kB/s"
+                             " | latency p50 %.1f p99 %.1f max %.1f ms (%d)"
+                             " | rss %.1f MB | %d plugs %d drops %d garbage %d stops %d warnings\n",
+                             seconds, plugged, mLinks.count(), tracks,
+                             (mCommands - mReportedCommands) * 1000. / REPORT_INTERVAL,
+                             link / 1024., (mHubBytes - mReportedHubBytes) / 1024. * 1000. / REPORT_INTERVAL,
+                             percentile(50), percentile(99), percentile(100), mLatencies.count(),
+                             memory, mPlugs, mDrops, mGarbage, mStops, sWarnings);
+    out.flush();
+    mReportedCommands = mCommands;
+    mReportedHubBytes = mHubBytes;
+    mLatencies.clear();
+}
+
+void Stress::finish()
+{
+    for (QTimer *timer : mTimers) {
+        timer->stop();
+    }
+    for (QLocalSocket *socket : mClients) {
+        socket->disconnectFromServer();
+    }
+    emergencyStop();
+    // Leave time for the stop frames and any late command to land.
+    QTimer::singleShot(1000, this, &Stress::check);
+}
+
+void Stress::check()
+{
+    report();
+    for (const Link &link : mLinks) {
+        if (!link.mDevice->plugged())
+            continue;
+        for (int id = 0; id < link.mDevice->tracks(); id++) {
+            if (link.mDevice->speed(id) != 0) {
+                qCritical() << "track" << id << "of" << link.mAddress << "still running at"
+                            << link.mDevice->speed(id) << "after the emergency stop";
+                mResult = 1;
+            }
+        }
+        if (link.mDevice->scheduled()) {
+            qCritical() << link.mAddress << "kept" << link.mDevice->scheduled()
+                        << "scheduled commands after the emergency stop";
+            mResult = 1;
+        }
+    }
+    QTextStream(stdout) << QString::asprintf("rss %.1f MB at start, %.1f MB peak, %s\n",
+                                             mFirstMemory, mPeakMemory,
+                                             mResult ? "FAILED" : "passed");
+    QCoreApplication::exit(mResult);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Stress the station with emulated devices and hub clients.");
+    parser.addHelpOption();
+    const QCommandLineOption duration("duration", "Run for <seconds>.", "seconds", "60");
+    const QCommandLineOption devices("devices", "Emulate <count> devices.", "count", "24");
+    const QCommandLineOption clients("clients", "Connect <count> hub clients.", "count", "8");
+    const QCommandLineOption seed("seed", "Random <seed>, the time by default.", "seed");
+    const QCommandLineOption verbose("verbose", "Print the station messages.");
+    parser.addOptions({duration, devices, clients, seed, verbose});
+    parser.process(app);
+
+    sVerbose = parser.isSet(verbose);
+    qInstallMessageHandler(messageHandler);
+    const uint random = parser.isSet(seed) ? parser.value(seed).toUInt()
+        : uint(QDateTime::currentMSecsSinceEpoch());
+    qsrand(random);
+    QTextStream(stdout) << "seed " << random << endl;
+
+    Stress stress(qMax(1, parser.value(devices).toInt()), qMax(0, parser.value(clients).toInt()),
+                  qMax(1, parser.value(duration).toInt()));
+    QTimer::singleShot(0, &stress, &Stress::start);
+    return app.exec();
+}
@@ -0,0 +1,149 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <QtTest>
+
+#include "emulateddevice.h"
+#include "controller.h"
+#include "groupcommand.h"
+#include "track.h"
+
+class tst_GroupCommand: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void sharedInstant();
+    void emergencyStop();
+    void staleState();
+
+private:
+    void plug(EmulatedDevice *device, const QString &address, Controller *&controller);
+
+    EmulatedDevice *mScheduledDevice = nullptr;
+    EmulatedDevice *mPlainDevice = nullptr;
+    Controller *mScheduledLink = nullptr;
+    Controller *mPlainLink = nullptr;
+    GroupCommand *mGroup = nullptr;
+    QList<Track*> mTracks;
+};
+
+void tst_GroupCommand::plug(EmulatedDevice *device, const QString &address,
+                            Controller *&controller)
+{
+    controller = device->connectController(address, this);
+    QVERIFY(controller);
+    QTRY_COMPARE(controller->tracks().count(), device->tracks());
+    for (Track *track : controller->tracks()) {
+        mGroup->addTrack(track);
+        track->acquire();
+        mTracks.append(track);
+    }
+}
+
+void tst_GroupCommand::init()
+{
+    mGroup = new GroupCommand(this);
+    mTracks.clear();
+    mScheduledDevice = new EmulatedDevice(2, Frame::FRAMING | Frame::TIMESTAMPS
+                                          | Frame::SCHEDULED, this);
+    mPlainDevice = new EmulatedDevice(2, Frame::NO_FEATURE, this);
+    plug(mScheduledDevice, QStringLiteral("scheduled"), mScheduledLink);
+    plug(mPlainDevice, QStringLiteral("plain"), mPlainLink);
+    if (QTest::currentTestFailed())
+        return;
+    for (Track *track : mTracks) {
+        QTRY_VERIFY(track->linked());
+    }
+
+    // The station asks for the time on pings.
+    mScheduledDevice->setClockOffset(123456789);
+    mScheduledDevice->sendPing();
+    QTRY_VERIFY(mScheduledLink->clockSync().synchronized());
+    QVERIFY(mScheduledLink->supports(Frame::SCHEDULED));
+    QVERIFY(!mPlainLink->supports(Frame::SCHEDULED));
+}
+
+void tst_GroupCommand::cleanup()
+{
+    delete mGroup;
+    delete mScheduledLink;
+    delete mPlainLink;
+    delete mScheduledDevice;
+    delete mPlainDevice;
+    mScheduledLink = nullptr;
+    mPlainLink = nullptr;
+}
+
+void tst_GroupCommand::sharedInstant()
+{
+    mGroup->send(mTracks, 0.5);
+    // Sent to the first generation device at the scheduled instant.
+    QVERIFY(mGroup->pending());
+    for (int id = 0; id < 2; id++) {
+        QTRY_COMPARE(mScheduledDevice->speed(id), EmulatedDevice::MAX_SPEED / 2);
+        QTRY_COMPARE(mPlainDevice->speed(id), EmulatedDevice::MAX_SPEED / 2);
+    }
+    QVERIFY(!mGroup->pending());
+}
+
+void tst_GroupCommand::emergencyStop()
+{
+    int moved = 0;
+    const auto count = [&moved] (int, int speed) {
+        if (speed)
+            moved += 1;
+    };
+    connect(mScheduledDevice, &EmulatedDevice::speedApplied, this, count);
+    connect(mPlainDevice, &EmulatedDevice::speedApplied, this, count);
+
+    mGroup->send(mTracks, 0.5);
+    for (int i = 0; i < 1000 && mScheduledDevice->scheduled() < 2; i++) {
+        QTest::qWait(1);
+    }
+    QCOMPARE(mScheduledDevice->scheduled(), 2);
+    QVERIFY(mGroup->pending());
+
+    for (Track *track : mTracks) {
+        mGroup->cancel(track);
+    }
+    mScheduledLink->emergencyStop();
+    mPlainLink->emergencyStop();
+    QVERIFY(!mGroup->pending());
+
+    // Well past the instant the group was scheduled for.
+    QTest::qWait(2 * GroupCommand::LEAD / 1000 + 200);
+    QCOMPARE(moved, 0);
+    QCOMPARE(mScheduledDevice->scheduled(), 0);
+    for (int id = 0; id < 2; id++) {
+        QCOMPARE(mScheduledDevice->speed(id), 0);
+        QCOMPARE(mPlainDevice->speed(id), 0);
+    }
+}
+
+void tst_GroupCommand::staleState()
+{
+    // Both tracks of the scheduled device apply the command at the
+    // same device instant.
+    const QList<Track*> tracks = mScheduledLink->tracks();
+    QSignalSpy skew(mGroup, &GroupCommand::skewChanged);
+    mGroup->send(tracks, 0.5);
+    QVERIFY(skew.isEmpty());
+
+    // A report sent before the command was applied, with another speed.
+    Track *track = tracks.first();
+    track->setState(Track::State(true, false, track->maxSpeed() / 10,
+                                 quint32(track->count()), qint32(track->position())));
+
+    // Nothing to dispatch from here, notified once the speed is reached.
+    QTRY_COMPARE(skew.count(), 1);
+    QVERIFY(mGroup->skew() < GroupCommand::LEAD / 2);
+}
+
+QTEST_GUILESS_MAIN(tst_GroupCommand)
+#include "tst_groupcommand.moc"
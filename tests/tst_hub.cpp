@@ -0,0 +1,116 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <QtTest>
+#include <QLocalSocket>
+
+#include "hub.h"
+#include "track.h"
+
+class tst_Hub: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void secondInstance();
+    void speedRange();
+    void ownership();
+
+private:
+    QLocalSocket* connectClient();
+
+    QString mName;
+    Hub *mHub = nullptr;
+    Track *mTrack = nullptr;
+};
+
+void tst_Hub::init()
+{
+    mName = QString::fromLatin1("train-station-tst-hub-%1").arg(QCoreApplication::applicationPid());
+    mHub = new Hub(this);
+    mTrack = new Track(this);
+    mTrack->setLinked(true);
+    mHub->addTrack(mTrack);
+    QVERIFY(mHub->listen(mName));
+}
+
+void tst_Hub::cleanup()
+{
+    delete mHub;
+    delete mTrack;
+}
+
+QLocalSocket* tst_Hub::connectClient()
+{
+    QLocalSocket *socket = new QLocalSocket(this);
+    socket->connectToServer(mName);
+    if (!socket->waitForConnected(1000))
+        return socket;
+    // The snapshot of the single track.
+    const int snapshot = Hub::Definition::SIZE + Hub::State::SIZE + Hub::SnapshotEnd::SIZE;
+    while (socket->bytesAvailable() < snapshot && socket->waitForReadyRead(1000)) {
+    }
+    socket->readAll();
+    return socket;
+}
+
+void tst_Hub::secondInstance()
+{
+    Hub second;
+    QVERIFY(!second.listen(mName));
+
+    // The first instance still serves.
+    QLocalSocket *client = connectClient();
+    QCOMPARE(client->state(), QLocalSocket::ConnectedState);
+    QTRY_COMPARE(mHub->clients(), 1);
+}
+
+void tst_Hub::speedRange()
+{
+    QLocalSocket *client = connectClient();
+    Hub::Acquire::Buffer acquire;
+    client->write(acquire, Hub::Acquire::encode(acquire, 0));
+    Hub::Speed::Buffer speed;
+    client->write(speed, Hub::Speed::encode(speed, 0, 3 * Hub::SPEED_SCALE));
+    QTRY_COMPARE(mTrack->requestedSpeed(), 1.f);
+    client->write(speed, Hub::Speed::encode(speed, 0, -Hub::SPEED_SCALE / 2));
+    QTRY_COMPARE(mTrack->requestedSpeed(), -0.5f);
+    client->write(speed, Hub::Speed::encode(speed, 0, qint32(0x80000000)));
+    QTRY_COMPARE(mTrack->requestedSpeed(), -1.f);
+}
+
+void tst_Hub::ownership()
+{
+    QVERIFY(mHub->requestSpeed(mTrack, 0.2f));
+    QCOMPARE(mTrack->requestedSpeed(), 0.2f);
+
+    QLocalSocket *owner = connectClient();
+    Hub::Acquire::Buffer acquire;
+    owner->write(acquire, Hub::Acquire::encode(acquire, 0));
+    Hub::Speed::Buffer speed;
+    owner->write(speed, Hub::Speed::encode(speed, 0, Hub::SPEED_SCALE / 2));
+    QTRY_COMPARE(mTrack->requestedSpeed(), 0.5f);
+
+    // Neither another client nor the station UI take it over.
+    QLocalSocket *other = connectClient();
+    other->write(acquire, Hub::Acquire::encode(acquire, 0));
+    other->write(speed, Hub::Speed::encode(speed, 0, Hub::SPEED_SCALE));
+    QTest::qWait(100);
+    QCOMPARE(mTrack->requestedSpeed(), 0.5f);
+    QVERIFY(!mHub->requestSpeed(mTrack, 0.8f));
+    QCOMPARE(mTrack->requestedSpeed(), 0.5f);
+
+    // Until it is released.
+    Hub::Release::Buffer release;
+    owner->write(release, Hub::Release::encode(release, 0));
+    QTRY_VERIFY(mHub->requestSpeed(mTrack, 0.8f));
+    QCOMPARE(mTrack->requestedSpeed(), 0.8f);
+}
+
+QTEST_GUILESS_MAIN(tst_Hub)
+#include "tst_hub.moc"
@@ -0,0 +1,124 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <QtTest>
+
+#include "timetable.h"
+#include "track.h"
+
+class tst_Timetable: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void resumeAfterStop();
+    void emergencyStopApproaching();
+    void emergencyStopInStation();
+
+private:
+    void moveTo(Track::Position position);
+
+    Timetable *mTimetable = nullptr;
+    Track *mTrack = nullptr;
+};
+
+void tst_Timetable::init()
+{
+    mTimetable = new Timetable(this);
+    mTrack = new Track(this);
+    mTrack->setLinked(true);
+    mTimetable->addTrack(mTrack);
+}
+
+void tst_Timetable::cleanup()
+{
+    delete mTrack;
+    delete mTimetable;
+}
+
+void tst_Timetable::moveTo(Track::Position position)
+{
+    const int speed = int(mTrack->requestedSpeed() * 4096);
+    mTrack->setState(Track::State(speed > 0, speed < 0, qAbs(speed),
+                                  quint32(mTrack->count()), qint32(position)));
+    QCOMPARE(mTrack->position(), position);
+}
+
+void tst_Timetable::resumeAfterStop()
+{
+    mTimetable->setStop(mTrack, 20);
+    mTrack->requestSpeed(0.5);
+    moveTo(Track::STOPPING);
+    QCOMPARE(mTrack->requestedSpeed(), 0.f);
+    moveTo(Track::IN_STATION);
+    QVERIFY(mTimetable->pending());
+    QTRY_COMPARE(mTrack->requestedSpeed(), 0.5f);
+    QVERIFY(!mTimetable->pending());
+}
+
+void tst_Timetable::emergencyStopApproaching()
+{
+    mTimetable->setStop(mTrack, 0);
+    mTrack->requestSpeed(0.5);
+    moveTo(Track::STOPPING);
+
+    // As Station::emergencyStop does.
+    mTimetable->cancel(mTrack);
+    mTrack->cancelCommands();
+    QVERIFY(mTimetable->suspended(mTrack));
+
+    moveTo(Track::IN_STATION);
+    QVERIFY(!mTimetable->pending());
+    QTest::qWait(50);
+    QCOMPARE(mTrack->requestedSpeed(), 0.f);
+
+    // Driven again by the user, the stop rule is back.
+    mTimetable->resume(mTrack);
+    QVERIFY(!mTimetable->suspended(mTrack));
+    mTrack->requestSpeed(0.3);
+    moveTo(Track::SOMEWHERE);
+    moveTo(Track::STOPPING);
+    QCOMPARE(mTrack->requestedSpeed(), 0.f);
+    moveTo(Track::IN_STATION);
+    QTRY_COMPARE(mTrack->requestedSpeed(), 0.3f);
+}
+
+void tst_Timetable::emergencyStopInStation()
+{
+    mTimetable->setStop(mTrack, 100, 0.4);
+    mTrack->requestSpeed(0.5);
+    moveTo(Track::STOPPING);
+    moveTo(Track::IN_STATION);
+    QVERIFY(mTimetable->pending());
+
+    QVERIFY(mTimetable->manages(mTrack));
+    QSignalSpy managed(mTimetable, &Timetable::managedChanged);
+    mTimetable->cancel(mTrack);
+    mTrack->cancelCommands();
+    QVERIFY(!mTimetable->pending());
+    QVERIFY(!mTimetable->manages(mTrack));
+    QCOMPARE(managed.count(), 1);
+
+    // A position glitch reported again by the device.
+    moveTo(Track::STOPPING);
+    moveTo(Track::IN_STATION);
+    QVERIFY(!mTimetable->pending());
+    QTest::qWait(200);
+    QCOMPARE(mTrack->requestedSpeed(), 0.f);
+
+    // Setting the rule again re-arms it.
+    mTimetable->setStop(mTrack, 0, 0.4);
+    QVERIFY(mTimetable->manages(mTrack));
+    QCOMPARE(managed.count(), 2);
+    moveTo(Track::SOMEWHERE);
+    moveTo(Track::IN_STATION);
+    QTRY_COMPARE(mTrack->requestedSpeed(), 0.4f);
+}
+
+QTEST_GUILESS_MAIN(tst_Timetable)
+#include "tst_timetable.moc"
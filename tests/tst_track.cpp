@@ -0,0 +1,82 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <QtTest>
+
+#include "controlclock.h"
+#include "track.h"
+
+class tst_Track: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void commandWhileMoving();
+    void steadyEstimate();
+
+private:
+    void runAt(float speed);
+
+    ControlClock *mClock = nullptr;
+    Track *mTrack = nullptr;
+};
+
+void tst_Track::init()
+{
+    mClock = new ControlClock(100, this);
+    mTrack = new Track(this);
+    mTrack->setLinked(true);
+    mTrack->setClock(mClock);
+    mTrack->setPrediction(true);
+}
+
+void tst_Track::cleanup()
+{
+    delete mTrack;
+    delete mClock;
+}
+
+void tst_Track::runAt(float speed)
+{
+    mTrack->requestSpeed(speed);
+    mTrack->setState(Track::State(1, 0, qint32(speed * 4096), 0, Track::SOMEWHERE));
+    // Past the tick following the command.
+    QTest::qWait(3 * mClock->interval());
+    QVERIFY(mClock->isSubscribed(mTrack));
+}
+
+void tst_Track::commandWhileMoving()
+{
+    runAt(0.5);
+
+    // The prediction keeps a moving track on the clock, it must not
+    // delay the next command to the following tick.
+    QSignalSpy sent(mTrack, &Track::speedRequest);
+    mTrack->requestSpeed(0.25);
+    QCOMPARE(sent.count(), 1);
+    QCOMPARE(sent.at(0).at(0).toInt(), 1024);
+
+    // Further commands are throttled to one per tick.
+    mTrack->requestSpeed(0.125);
+    QCOMPARE(sent.count(), 1);
+    QTRY_COMPARE(sent.count(), 2);
+    QCOMPARE(sent.at(1).at(0).toInt(), 512);
+}
+
+void tst_Track::steadyEstimate()
+{
+    runAt(0.5);
+
+    QSignalSpy estimate(mTrack, &Track::estimateChanged);
+    QTest::qWait(3 * mClock->interval());
+    QCOMPARE(estimate.count(), 0);
+    QCOMPARE(mTrack->estimatedSpeed(), 0.5f);
+}
+
+QTEST_GUILESS_MAIN(tst_Track)
+#include "tst_track.moc"
@@ -0,0 +1,144 @@
+/*
+ * This file is part of train-station.
+ * SPDX-FileCopyrightText: 2023 Damien Caliste
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <QtTest>
+#include <QQuickWindow>
+#include <QOpenGLContext>
+
+#include "trackoverview.h"
+#include "track.h"
+
+// Frame times of the overview with many tracks, run with -vb for
+// the figures. One track changes state per frame, then all of them.
+class tst_TrackOverview: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void hitTest();
+    void finalFrameBeforeIdle();
+    void oneTrackPerFrame();
+    void allTracksPerFrame();
+
+private:
+    void moveAll(int step, int first, int last);
+    void render();
+
+    static const int TRACKS = 150;
+
+    QQuickWindow *mWindow = nullptr;
+    TrackOverview *mOverview = nullptr;
+    QList<Track*> mTracks;
+    int mStep = 0;
+};
+
+void tst_TrackOverview::initTestCase()
+{
+    QVariantList tracks;
+    for (int i = 0; i < TRACKS; i++) {
+        Track *track = new Track(this);
+        track->setLinked(true);
+        mTracks.append(track);
+        tracks.append(QVariant::fromValue(static_cast<QObject*>(track)));
+    }
+    mOverview = new TrackOverview;
+    mOverview->setSize(QSizeF(400, TRACKS * 16));
+    mOverview->setTracks(tracks);
+    mOverview->setCurrent(mTracks.first());
+
+    // Hit testing needs no rendering, the other cases do.
+    QOpenGLContext context;
+    if (!context.create())
+        return;
+    mWindow = new QQuickWindow;
+    mWindow->resize(mOverview->size().toSize());
+    mOverview->setParentItem(mWindow->contentItem());
+    mWindow->show();
+    QVERIFY(QTest::qWaitForWindowExposed(mWindow));
+    render();
+}
+
+void tst_TrackOverview::cleanupTestCase()
+{
+    delete mOverview;
+    delete mWindow;
+    qDeleteAll(mTracks);
+}
+
+void tst_TrackOverview::hitTest()
+{
+    QCOMPARE(mOverview->indexAt(-1.), -1);
+    QCOMPARE(mOverview->indexAt(0.), 0);
+    QCOMPARE(mOverview->trackAt(mOverview->height() - 1.), mTracks.last());
+    QCOMPARE(mOverview->indexAt(mOverview->height()), -1);
+}
+
+void tst_TrackOverview::finalFrameBeforeIdle()
+{
+    if (!mWindow)
+        QSKIP("no OpenGL context to render with");
+    Track *track = mTracks.first();
+    track->setState(Track::State(true, false, 2048, 0, Track::PASSING_BY));
+    const QImage moving = mWindow->grabWindow();
+
+    // Like the cover binding on InterConnect.idle, the pause comes
+    // from the stop itself, before the overview hears of it.
+    QMetaObject::Connection idle = connect(track, &Track::speedChanged,
+                                           mOverview, [this] () {mOverview->setPaused(true);});
+    track->setState(Track::State(false, false, 0, 0, Track::IN_STATION));
+    QObject::disconnect(idle);
+    QVERIFY(mOverview->paused());
+    const QImage stopped = mWindow->grabWindow();
+    QVERIFY(stopped != moving);
+
+    mOverview->setPaused(false);
+    QCOMPARE(mWindow->grabWindow(), stopped);
+}
+
+void tst_TrackOverview::oneTrackPerFrame()
+{
+    if (!mWindow)
+        QSKIP("no OpenGL context to render with");
+    QBENCHMARK {
+        const int index = mStep % TRACKS;
+        moveAll(mStep++, index, index);
+        render();
+    }
+    qDebug() << "vertex update of the last frame" << mOverview->updateTime() << "us";
+}
+
+void tst_TrackOverview::allTracksPerFrame()
+{
+    if (!mWindow)
+        QSKIP("no OpenGL context to render with");
+    QBENCHMARK {
+        moveAll(mStep++, 0, TRACKS - 1);
+        render();
+    }
+    qDebug() << "vertex update of the last frame" << mOverview->updateTime() << "us";
+}
+
+void tst_TrackOverview::moveAll(int step, int first, int last)
+{
+    for (int i = first; i <= last; i++) {
+        const qint32 speed = (step + i) % 4096;
+        // A passage every few steps, to redraw the labels too.
+        mTracks[i]->setState(Track::State(true, false, speed,
+                                          quint32(step / 16),
+                                          qint32(step % 6)));
+    }
+}
+
+void tst_TrackOverview::render()
+{
+    // Synchronous, the scene graph being updated then drawn.
+    mWindow->grabWindow();
+}
+
+QTEST_MAIN(tst_TrackOverview)
+#include "tst_trackoverview.moc"